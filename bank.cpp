@@ -0,0 +1,222 @@
+#include "bank.h"
+
+#include <algorithm>
+
+#if defined(__SSE2__) || defined(_M_X64) || \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define ENABLE_SSE2 (1)
+#include <emmintrin.h>
+#endif
+
+#if defined(_MSC_VER) && defined(_M_X64)
+#include <intrin.h>
+#endif
+
+namespace base {
+
+// The number of columns computed by each task.
+const uint32 kFeatureBankBlockSize = 16;
+
+// Returns the number of set bits in value.
+inline uint32 CountBits(uint64 value) {
+#if defined(_MSC_VER) && defined(_M_X64)
+  return static_cast<uint32>(__popcnt64(value));
+#elif defined(__GNUC__) || defined(__clang__)
+  return __builtin_popcountll(value);
+#else
+  uint32 count = 0;
+  for (; value; count++) {
+    value &= value - 1;
+  }
+  return count;
+#endif
+}
+
+bool FeatureBank::Initialize(const DecisionTreeParams &params,
+                             const TrainSet &train_set,
+                             uint32 training_start_index,
+                             uint32 training_count, RandomGenerator *random,
+                             TaskScheduler *scheduler, string *error) {
+  if (!params.feature_bank_size || !train_set.data || !random ||
+      training_count > train_set.data->GetImageCount()) {
+    if (error) {
+      *error = "Invalid parameter(s) specified to FeatureBank::Initialize.";
+    }
+    return false;
+  }
+
+  train_set_ = train_set;
+  start_index_ = training_start_index;
+  training_count_ = training_count;
+  image_count_ = train_set.data->GetImageCount();
+  pixel_count_ = train_set.width * train_set.height;
+  column_word_count_ = (uint64(training_count) * pixel_count_ + 63) / 64;
+
+  functions_.resize(params.feature_bank_size);
+
+  for (auto &function : functions_) {
+    function.Initialize(params.visual_search_radius, random);
+  }
+
+  columns_.assign(column_word_count_ * functions_.size(), 0);
+
+  uint32 function_count = functions_.size();
+
+  if (scheduler) {
+    TaskGroup column_group;
+
+    for (uint32 i = 0; i < function_count; i += kFeatureBankBlockSize) {
+      uint32 end = ::std::min(i + kFeatureBankBlockSize, function_count);
+      scheduler->Spawn(&column_group,
+                       [this, i, end]() { ComputeColumns(i, end); });
+    }
+
+    scheduler->Wait(&column_group);
+  } else {
+    ComputeColumns(0, function_count);
+  }
+
+  return true;
+}
+
+uint64 FeatureBank::EstimateMemory(const DecisionTreeParams &params,
+                                   uint64 sample_count) {
+  // A node holds at most one mask word per class for every column word.
+  uint64 column_size = (sample_count + 63) / 64 * sizeof(uint64);
+  return column_size * params.feature_bank_size +
+         column_size * 2 * params.class_count;
+}
+
+void FeatureBank::ComputeColumns(uint32 function_start, uint32 function_end) {
+  uint32 width = train_set_.width;
+  uint32 height = train_set_.height;
+  uint32 row_stride = train_set_.row_stride;
+
+  // Images are visited once per block of functions, so that each image is
+  // read from memory once and then served from the cache.
+  for (uint32 i = 0; i < training_count_; i++) {
+    uint32 index = (start_index_ + i) % image_count_;
+    const uint8 *image = train_set_.data->GetImageData(index);
+
+    for (uint32 k = function_start; k < function_end; k++) {
+      const SplitFunction &function = functions_[k];
+      uint64 position = uint64(i) * pixel_count_;
+      uint64 *word = &columns_[k * column_word_count_ + (position >> 6)];
+      uint32 bit = position & 63;
+      uint64 bits = 0;
+      int32 threshold = function.GetThreshold();
+      int32 offset0, offset1;
+
+      function.GetPaddedProbeOffsets(width, height, row_stride, &offset0,
+                                     &offset1);
+
+      // Responses are gathered into bits, which are written out one word
+      // at a time.
+      auto append_bits = [&](uint64 value, uint32 count) {
+        bits |= value << bit;
+        bit += count;
+
+        if (bit >= 64) {
+          *word++ |= bits;
+          bit -= 64;
+          bits = bit ? value >> (count - bit) : 0;
+        }
+      };
+
+      for (uint32 y = 0; y < height; y++) {
+        const uint8 *row = image + y * row_stride;
+        uint32 x = 0;
+
+#if ENABLE_SSE2
+        // Padded rows with a zero threshold compare 16 samples at a time.
+        if (train_set_.is_padded && !threshold) {
+          for (; x + 16 <= width; x += 16) {
+            const uint8 *sample = row + x;
+            __m128i value0 =
+                _mm_loadu_si128((const __m128i *)(sample + offset0));
+            __m128i value1 =
+                _mm_loadu_si128((const __m128i *)(sample + offset1));
+            // value1 > value0 unless max(value0, value1) == value0.
+            __m128i left =
+                _mm_cmpeq_epi8(_mm_max_epu8(value0, value1), value0);
+            append_bits(~_mm_movemask_epi8(left) & 0xFFFF, 16);
+          }
+        }
+#endif
+
+        for (; x < width; x++) {
+          bool goes_right = false;
+
+          if (train_set_.is_padded) {
+            const uint8 *sample = row + x;
+            goes_right = int32(sample[offset1]) - sample[offset0] > threshold;
+          } else {
+            goes_right = train_set_.Split(
+                function, train_set_.GetSampleId(index, x, y));
+          }
+
+          append_bits(goes_right, 1);
+        }
+      }
+
+      if (bit) {
+        *word |= bits;
+      }
+    }
+  }
+}
+
+void FeatureBankNode::Initialize(const FeatureBank *bank, uint32 class_count,
+                                 const uint32 *samples, uint32 sample_count) {
+  bank_ = bank;
+  class_count_ = class_count;
+  class_words_.resize(class_count);
+  class_totals_.assign(class_count, 0);
+
+  for (auto &words : class_words_) {
+    words.clear();
+  }
+
+  // Samples are usually in training set order, in which case consecutive
+  // samples of a class share mask words.
+  for (uint32 j = 0; j < sample_count; j++) {
+    uint8 label = bank->train_set_.GetLabel(samples[j]);
+
+    if (label >= class_count) {
+      continue;
+    }
+
+    uint32 position = bank->GetPosition(samples[j]);
+    uint64 word = position >> 6;
+    uint64 bit = 1ULL << (position & 63);
+    auto &words = class_words_[label];
+
+    if (words.empty() || words.back().first != word) {
+      words.push_back(::std::make_pair(word, bit));
+    } else {
+      words.back().second |= bit;
+    }
+
+    class_totals_[label]++;
+  }
+}
+
+void FeatureBankNode::GetLeftHistogram(uint32 function_index,
+                                       Histogram *output) const {
+  const uint64 *column =
+      &bank_->columns_[function_index * bank_->column_word_count_];
+
+  output->Initialize(class_count_);
+
+  for (uint32 i = 0; i < class_count_; i++) {
+    uint32 right_total = 0;
+
+    for (const auto &word : class_words_[i]) {
+      right_total += CountBits(column[word.first] & word.second);
+    }
+
+    output->IncrementValue(i, class_totals_[i] - right_total);
+  }
+}
+
+}  // namespace base
\ No newline at end of file
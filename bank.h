@@ -0,0 +1,129 @@
+/*
+//
+// Copyright (c) 1998-2019 Joe Bertolami. All Right Reserved.
+//
+//   Redistribution and use in source and binary forms, with or without
+//   modification, are permitted provided that the following conditions are met:
+//
+//   * Redistributions of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//
+//   * Redistributions in binary form must reproduce the above copyright notice,
+//     this list of conditions and the following disclaimer in the documentation
+//     and/or other materials provided with the distribution.
+//
+//   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+//   AND ANY EXPRESS OR IMPLIED WARRANTIES, CLUDG, BUT NOT LIMITED TO, THE
+//   IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+//   ARE DISCLAIMED.  NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+//   LIABLE FOR ANY DIRECT, DIRECT, CIDENTAL, SPECIAL, EXEMPLARY, OR
+//   CONSEQUENTIAL DAMAGES (CLUDG, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+//   GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSESS TERRUPTION)
+//   HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER  CONTRACT, STRICT
+//   LIABILITY, OR TORT (CLUDG NEGLIGENCE OR OTHERWISE) ARISG  ANY WAY  OF THE
+//   USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// Additional Information:
+//
+//   For more information, visit http://www.bertolami.com.
+//
+*/
+
+#ifndef __BANK_H__
+#define __BANK_H__
+
+#include <utility>
+#include <vector>
+
+#include "base_types.h"
+#include "histogram.h"
+#include "random.h"
+#include "scheduler.h"
+#include "split.h"
+#include "tree.h"
+
+using ::std::pair;
+using ::std::vector;
+
+namespace base {
+
+// A fixed pool of candidate split functions, drawn once per tree, along
+// with the response of every training sample to each of them. Responses
+// are stored as one bit per sample (set if the sample goes right), packed
+// into a column of 64 bit words per function. Columns are indexed by a
+// sample's position within the tree's training set, so a node's split
+// search reduces to masking and counting the bits of its own samples.
+class FeatureBank {
+ public:
+  // Draws params.feature_bank_size split functions and computes the
+  // responses of every pixel of training_count images, starting at image
+  // training_start_index (wrapping around the dataset), to each of them.
+  // If a scheduler is supplied, columns are computed concurrently.
+  bool Initialize(const DecisionTreeParams &params, const TrainSet &train_set,
+                  uint32 training_start_index, uint32 training_count,
+                  RandomGenerator *random, TaskScheduler *scheduler,
+                  string *error = nullptr);
+  // Estimates the bytes used by a bank for sample_count samples.
+  static uint64 EstimateMemory(const DecisionTreeParams &params,
+                               uint64 sample_count);
+
+  uint32 GetFunctionCount() const { return functions_.size(); }
+  const SplitFunction &GetFunction(uint32 index) const {
+    return functions_[index];
+  }
+
+  // Returns true if the sample goes right under a function of the bank.
+  bool GetResponse(uint32 function_index, uint32 sample) const {
+    uint32 position = GetPosition(sample);
+    return (columns_[function_index * column_word_count_ + (position >> 6)] >>
+            (position & 63)) &
+           0x1;
+  }
+
+ private:
+  // Returns the position of a sample within the tree's training set.
+  uint32 GetPosition(uint32 sample) const {
+    uint32 image_index = train_set_.GetImageIndex(sample);
+    uint32 relative_index =
+        (image_index + image_count_ - start_index_) % image_count_;
+    return relative_index * pixel_count_ + train_set_.GetPixelOffset(sample);
+  }
+
+  // Computes the columns of functions [function_start, function_end).
+  void ComputeColumns(uint32 function_start, uint32 function_end);
+
+  TrainSet train_set_;
+  uint32 start_index_;
+  uint32 training_count_;
+  uint32 image_count_;
+  uint32 pixel_count_;
+  uint64 column_word_count_;
+  vector<SplitFunction> functions_;
+  vector<uint64> columns_;
+  friend class FeatureBankNode;
+};
+
+// The samples of a node, arranged for counting against the columns of a
+// FeatureBank. For each class, we store the column words that hold any of
+// the node's samples of that class, along with a mask of their bits.
+class FeatureBankNode {
+ public:
+  // Gathers sample_count samples. Samples with labels outside of
+  // class_count are ignored, as they are by SplitEvaluator.
+  void Initialize(const FeatureBank *bank, uint32 class_count,
+                  const uint32 *samples, uint32 sample_count);
+  // Retrieves the histogram of samples that a function of the bank sends
+  // left.
+  void GetLeftHistogram(uint32 function_index, Histogram *output) const;
+
+ private:
+  const FeatureBank *bank_;
+  uint32 class_count_;
+  // Per-class (word index, sample mask) pairs, and per-class totals.
+  vector<vector<pair<uint64, uint64>>> class_words_;
+  vector<uint32> class_totals_;
+};
+
+}  // namespace base
+
+#endif  // __BANK_H__
\ No newline at end of file
@@ -0,0 +1,244 @@
+#include "compiled.h"
+
+#include <cstring>
+
+namespace base {
+
+// The parent of each root node.
+const uint32 kNoParentNode = 0xFFFFFFFF;
+
+bool CompiledForest::Compile(const vector<DecisionTree>& trees,
+                             uint32 class_count, string* error) {
+  Clear();
+
+  if (!class_count || class_count > kMaxClassCount) {
+    if (error) {
+      *error = "Invalid parameter(s) specified to CompiledForest::Compile.";
+    }
+    return false;
+  }
+
+  lane_count_ =
+      (class_count + kHistogramLaneCount - 1) & ~(kHistogramLaneCount - 1);
+
+  // Nodes are flattened depth first, so a left child always immediately
+  // follows its parent (until the forest is reordered). Each pending node
+  // records the parent link that must refer to it once its own link is
+  // known.
+  typedef struct PendingNode {
+    const DecisionNode* node;
+    uint32 parent_index;
+    uint32 side;
+  } PendingNode;
+
+  vector<PendingNode> node_stack;
+
+  for (auto& tree : trees) {
+    if (!tree.root_node_) {
+      if (error) {
+        *error = "Invalid root node detected.";
+      }
+      Clear();
+      return false;
+    }
+
+    node_stack.push_back({tree.root_node_.get(), kNoParentNode, 0});
+
+    while (!node_stack.empty()) {
+      PendingNode pending = node_stack.back();
+      const DecisionNode* node = pending.node;
+      uint32 link = 0;
+
+      node_stack.pop_back();
+
+      if (!node->is_leaf_ && (!node->left_child_ || !node->right_child_)) {
+        if (error) {
+          *error = "Invalid tree structure.";
+        }
+        Clear();
+        return false;
+      }
+
+      if (node->is_leaf_) {
+        link = (leaf_posteriors_.size() / lane_count_) | kCompiledLeafLink;
+
+        for (uint32 i = 0; i < lane_count_; i++) {
+          leaf_posteriors_.push_back(node->histogram_.GetPercentage(i));
+        }
+      } else {
+        CompiledNode compiled_node = {0, 0, node->function_.GetThreshold(),
+                                      {0, 0}};
+        SplitCoord offset0, offset1;
+
+        node->function_.GetProbeOffsets(&offset0, &offset1);
+        link = nodes_.size();
+        nodes_.push_back(compiled_node);
+        probe_offsets_.push_back(offset0);
+        probe_offsets_.push_back(offset1);
+
+        // The right child is pushed first so that the left is popped next.
+        node_stack.push_back({node->right_child_.get(), link, 1});
+        node_stack.push_back({node->left_child_.get(), link, 0});
+      }
+
+      if (kNoParentNode == pending.parent_index) {
+        tree_links_.push_back(link);
+      } else {
+        nodes_[pending.parent_index].child_links[pending.side] = link;
+      }
+    }
+  }
+
+  return true;
+}
+
+void CompiledForest::ClassifyBatch(const uint8* origin,
+                                   const int32* sample_offsets,
+                                   uint32 sample_count, CompiledBatch* batch,
+                                   uint8* sample_classes) const {
+  // Resizing to our batch size only allocates on first use.
+  batch->active_samples.resize(kCompiledBatchSize);
+  batch->active_links.resize(kCompiledBatchSize);
+  batch->posteriors.resize(kCompiledBatchSize * lane_count_);
+
+  uint32* active_samples = batch->active_samples.data();
+  uint32* active_links = batch->active_links.data();
+  float32* posteriors = batch->posteriors.data();
+
+  memset(posteriors, 0, sample_count * lane_count_ * sizeof(float32));
+
+  for (auto root_link : tree_links_) {
+    uint32 active_count = sample_count;
+
+    for (uint32 i = 0; i < sample_count; i++) {
+      active_samples[i] = i;
+      active_links[i] = root_link;
+    }
+
+    // Each pass advances every active sample by one level. Samples that
+    // reach a leaf collect its vote and leave the active list, which is
+    // compacted in place.
+    while (active_count) {
+      uint32 next_active_count = 0;
+
+      for (uint32 i = 0; i < active_count; i++) {
+        uint32 sample_index = active_samples[i];
+        uint32 link = active_links[i];
+
+        if (link & kCompiledLeafLink) {
+          AddClassPosteriors(GetLeafPosteriors(link & ~kCompiledLeafLink),
+                             lane_count_,
+                             posteriors + sample_index * lane_count_);
+          continue;
+        }
+
+        const CompiledNode& node = nodes_[link];
+        const uint8* sample = origin + sample_offsets[sample_index];
+        int32 difference = int32(sample[node.offset1]) - sample[node.offset0];
+
+        active_samples[next_active_count] = sample_index;
+        active_links[next_active_count++] =
+            node.child_links[difference > node.threshold];
+      }
+
+      active_count = next_active_count;
+    }
+  }
+
+  for (uint32 i = 0; i < sample_count; i++) {
+    sample_classes[i] =
+        FindDominantPosterior(posteriors + i * lane_count_, lane_count_);
+  }
+}
+
+void CompiledForest::Reorder(const vector<uint64>& visits) {
+  vector<CompiledNode> ordered_nodes;
+  vector<SplitCoord> ordered_probe_offsets;
+  vector<uint32> ordered_tree_links;
+  vector<float32> ordered_leaf_posteriors;
+
+  // Each pending link records the parent link that must refer to it, as
+  // in Compile.
+  typedef struct PendingLink {
+    uint32 link;
+    uint32 parent_index;
+    uint32 side;
+  } PendingLink;
+
+  vector<PendingLink> link_stack;
+
+  for (auto root_link : tree_links_) {
+    link_stack.push_back({root_link, kNoParentNode, 0});
+
+    while (!link_stack.empty()) {
+      PendingLink pending = link_stack.back();
+      uint32 link = 0;
+
+      link_stack.pop_back();
+
+      if (pending.link & kCompiledLeafLink) {
+        const float32* posteriors =
+            GetLeafPosteriors(pending.link & ~kCompiledLeafLink);
+        link = (ordered_leaf_posteriors.size() / lane_count_) |
+               kCompiledLeafLink;
+        ordered_leaf_posteriors.insert(ordered_leaf_posteriors.end(),
+                                       posteriors, posteriors + lane_count_);
+      } else {
+        const CompiledNode& node = nodes_[pending.link];
+        uint32 hot_side =
+            visits[2 * pending.link + 1] > visits[2 * pending.link];
+
+        link = ordered_nodes.size();
+        ordered_nodes.push_back(node);
+        ordered_probe_offsets.push_back(probe_offsets_[2 * pending.link]);
+        ordered_probe_offsets.push_back(probe_offsets_[2 * pending.link + 1]);
+
+        // The hot child is pushed last so that it is popped next.
+        link_stack.push_back({node.child_links[!hot_side], link, !hot_side});
+        link_stack.push_back({node.child_links[hot_side], link, hot_side});
+      }
+
+      if (kNoParentNode == pending.parent_index) {
+        ordered_tree_links.push_back(link);
+      } else {
+        ordered_nodes[pending.parent_index].child_links[pending.side] = link;
+      }
+    }
+  }
+
+  nodes_.swap(ordered_nodes);
+  probe_offsets_.swap(ordered_probe_offsets);
+  tree_links_.swap(ordered_tree_links);
+  leaf_posteriors_.swap(ordered_leaf_posteriors);
+}
+
+void CompiledForest::Clear() {
+  nodes_.clear();
+  probe_offsets_.clear();
+  tree_links_.clear();
+  leaf_posteriors_.clear();
+  lane_count_ = 0;
+  bound_width_ = 0;
+  bound_height_ = 0;
+  bound_row_stride_ = 0;
+}
+
+void CompiledForest::Bind(uint32 width, uint32 height, uint32 row_stride) {
+  if (width == bound_width_ && height == bound_height_ &&
+      row_stride == bound_row_stride_) {
+    return;
+  }
+
+  for (uint32 i = 0; i < nodes_.size(); i++) {
+    nodes_[i].offset0 =
+        GetPaddedOffset(width, height, row_stride, probe_offsets_[2 * i]);
+    nodes_[i].offset1 =
+        GetPaddedOffset(width, height, row_stride, probe_offsets_[2 * i + 1]);
+  }
+
+  bound_width_ = width;
+  bound_height_ = height;
+  bound_row_stride_ = row_stride;
+}
+
+}  // namespace base
\ No newline at end of file
@@ -0,0 +1,162 @@
+/*
+//
+// Copyright (c) 1998-2019 Joe Bertolami. All Right Reserved.
+//
+//   Redistribution and use in source and binary forms, with or without
+//   modification, are permitted provided that the following conditions are met:
+//
+//   * Redistributions of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//
+//   * Redistributions in binary form must reproduce the above copyright notice,
+//     this list of conditions and the following disclaimer in the documentation
+//     and/or other materials provided with the distribution.
+//
+//   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+//   AND ANY EXPRESS OR IMPLIED WARRANTIES, CLUDG, BUT NOT LIMITED TO, THE
+//   IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+//   ARE DISCLAIMED.  NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+//   LIABLE FOR ANY DIRECT, DIRECT, CIDENTAL, SPECIAL, EXEMPLARY, OR
+//   CONSEQUENTIAL DAMAGES (CLUDG, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+//   GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSESS TERRUPTION)
+//   HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER  CONTRACT, STRICT
+//   LIABILITY, OR TORT (CLUDG NEGLIGENCE OR OTHERWISE) ARISG  ANY WAY  OF THE
+//   USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// Additional Information:
+//
+//   For more information, visit http://www.bertolami.com.
+//
+*/
+
+#ifndef __COMPILED_H__
+#define __COMPILED_H__
+
+#include <vector>
+
+#include "base_types.h"
+#include "histogram.h"
+#include "split.h"
+#include "tree.h"
+
+using ::std::vector;
+
+namespace base {
+
+// Child links with this bit set refer to a leaf (by leaf index) rather
+// than to a node.
+const uint32 kCompiledLeafLink = 0x80000000;
+
+// The largest number of samples that CompiledForest::ClassifyBatch
+// classifies at once.
+const uint32 kCompiledBatchSize = 1024;
+
+// Scratch space for CompiledForest::ClassifyBatch, which may be reused
+// across batches so that classification does not allocate.
+typedef struct CompiledBatch {
+  // The samples that have yet to reach a leaf of the current tree, and the
+  // link that each will follow next.
+  vector<uint32> active_samples;
+  vector<uint32> active_links;
+  // The class posteriors accumulated for each sample.
+  vector<float32> posteriors;
+} CompiledBatch;
+
+// A split node of a compiled tree. Nodes are plain data, so that each tree
+// occupies a single contiguous array.
+typedef struct CompiledNode {
+  // The byte offsets, relative to the sample, of the two probes compared by
+  // the node's split function (see SplitFunction::GetPaddedProbeOffsets).
+  int32 offset0;
+  int32 offset1;
+  // Samples whose probe difference exceeds this go right.
+  int32 threshold;
+  // The left and right child links, each a node index within the forest or
+  // a leaf index combined with kCompiledLeafLink.
+  uint32 child_links[2];
+} CompiledNode;
+
+// A flattened copy of a trained forest that classifies padded samples (see
+// Dataset) without recursion or pointer chasing. The nodes of every tree
+// are stored in one array, in depth first order, and the class posteriors
+// of every leaf are stored in one table.
+//
+// Leaf posteriors are normalized, so each tree casts an equal vote for
+// every sample, regardless of how many training samples reached its leaf.
+class CompiledForest {
+ public:
+  // Flattens trees, whose leaves count class_count classes.
+  bool Compile(const vector<DecisionTree>& trees, uint32 class_count,
+               string* error = nullptr);
+  // Releases our trees.
+  void Clear();
+  bool IsEmpty() const { return tree_links_.empty(); }
+  // Resolves our probe offsets for images of the specified dimensions and
+  // row stride. Rebinding to the current layout does nothing.
+  void Bind(uint32 width, uint32 height, uint32 row_stride);
+  // Returns the lane padded class posteriors of a leaf.
+  const float32* GetLeafPosteriors(uint32 leaf_index) const {
+    return &leaf_posteriors_[leaf_index * lane_count_];
+  }
+  // Classifies sample_count samples (at most kCompiledBatchSize), each
+  // located at its byte offset from origin, and stores the dominant class
+  // of each in sample_classes. Each tree advances every sample by one level
+  // at a time, so that its upper nodes remain in cache while the whole
+  // batch is evaluated against them. Results exactly match those of
+  // classifying each sample on its own.
+  void ClassifyBatch(const uint8* origin, const int32* sample_offsets,
+                     uint32 sample_count, CompiledBatch* batch,
+                     uint8* sample_classes) const;
+  // Counts the branches that sample takes within each tree. visits holds
+  // two values per node, which count the samples that went left and right.
+  void CountBranches(const uint8* sample, uint64* visits) const {
+    for (uint32 i = 0; i < tree_links_.size(); i++) {
+      uint32 link = tree_links_[i];
+
+      while (!(link & kCompiledLeafLink)) {
+        const CompiledNode& node = nodes_[link];
+        int32 difference = int32(sample[node.offset1]) - sample[node.offset0];
+        uint32 side = difference > node.threshold;
+        visits[2 * link + side]++;
+        link = node.child_links[side];
+      }
+    }
+  }
+  // Reorders the nodes of each tree, depth first, so that the child that
+  // visits (see CountBranches) shows to be taken more often immediately
+  // follows its parent, and the leaves of each tree in the order that they
+  // are then reached. Samples that follow the dominant paths then read
+  // consecutive nodes. Classification results are unchanged.
+  void Reorder(const vector<uint64>& visits);
+  // Queries the number of split nodes across all trees.
+  uint32 GetNodeCount() const { return nodes_.size(); }
+  // Queries the number of class posteriors per leaf, which is the class
+  // count rounded up to a whole number of histogram lanes.
+  uint32 GetLaneCount() const { return lane_count_; }
+  // Queries the number of bytes used by our nodes and leaf posteriors.
+  uint64 GetSize() const {
+    return nodes_.size() * sizeof(CompiledNode) +
+           leaf_posteriors_.size() * sizeof(float32);
+  }
+
+ private:
+  // Our split nodes, and the two probe offsets of each, which are kept
+  // apart from our nodes as they are only needed by Bind.
+  vector<CompiledNode> nodes_;
+  vector<SplitCoord> probe_offsets_;
+  // The link to the root of each tree.
+  vector<uint32> tree_links_;
+  // lane_count_ class posteriors for each leaf.
+  vector<float32> leaf_posteriors_;
+  uint32 lane_count_ = 0;
+  // The layout that our nodes are bound to.
+  uint32 bound_width_ = 0;
+  uint32 bound_height_ = 0;
+  uint32 bound_row_stride_ = 0;
+  // Quantization compacts our trees.
+  friend class QuantizedForest;
+};
+
+}  // namespace base
+
+#endif  // __COMPILED_H__
\ No newline at end of file
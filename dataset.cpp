@@ -0,0 +1,426 @@
+#include "dataset.h"
+
+#include <cstring>
+
+#include "numeric.h"
+
+#if !defined(BASE_PLATFORM_WINDOWS)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+namespace base {
+
+// Dataset files hold this header, padded to kDatasetAlignment bytes, and
+// then the image slab, the label slab and the codex of each image.
+typedef struct DatasetFileHeader {
+  uint32 magic;
+  uint32 version;
+  uint32 image_count;
+  uint32 width;
+  uint32 height;
+  uint32 border;
+  uint32 label_count;
+} DatasetFileHeader;
+
+// Reflects a coordinate back into [0, size) exactly as ProjectCoord does.
+// Coordinates beyond a single reflection are never probed, and are clamped.
+int32 MirrorCoord(int32 value, int32 size) {
+  if (value < 0) value = -1 * value;
+
+  if (value >= size - 1) {
+    value = ((size - 1) << 0x1) - value;
+  }
+
+  return clip_range(value, 0, size - 1);
+}
+
+Dataset::Dataset()
+    : image_count_(0),
+      width_(0),
+      height_(0),
+      border_(0),
+      row_stride_(0),
+      image_stride_(0),
+      label_stride_(0),
+      image_origin_(0),
+      image_data_(nullptr),
+      label_data_(nullptr),
+      map_address_(nullptr),
+      map_size_(0) {}
+
+Dataset::~Dataset() { Unmap(); }
+
+bool Dataset::SetLayout(uint32 image_count, uint32 width, uint32 height,
+                        uint32 border, string *error) {
+  uint32 max_border = (width > height ? width : height) >> 0x1;
+  border = border > max_border ? max_border : border;
+
+  uint64 image_size =
+      uint64(width + 2 * border) * (height + 2 * border);
+
+  if (!image_count || !width || !height ||
+      image_size > BASE_MAX_UINT32 - kDatasetAlignment) {
+    if (error) {
+      *error = "Invalid parameter(s) specified to Dataset::Initialize.";
+    }
+    return false;
+  }
+
+  image_count_ = image_count;
+  width_ = width;
+  height_ = height;
+  border_ = border;
+  row_stride_ = width + 2 * border;
+  image_stride_ = align(image_size, kDatasetAlignment);
+  label_stride_ = align(width * height, kDatasetAlignment);
+  image_origin_ = border * row_stride_ + border;
+
+  return true;
+}
+
+bool Dataset::Initialize(uint32 image_count, uint32 width, uint32 height,
+                         uint32 border, string *error) {
+  Unmap();
+
+  if (!SetLayout(image_count, width, height, border, error)) {
+    return false;
+  }
+
+  image_slab_.assign(size_t(image_stride_) * image_count, 0);
+  label_slab_.assign(size_t(label_stride_) * image_count, 0);
+  codices_.assign(image_count, 0);
+  image_data_ = image_slab_.data();
+  label_data_ = label_slab_.data();
+
+  return true;
+}
+
+bool Dataset::Map(const string &filename, uint32 *label_count,
+                  string *error) {
+  Unmap();
+  image_slab_.clear();
+  label_slab_.clear();
+
+  uint8 *address = nullptr;
+  uint64 size = 0;
+
+#if defined(BASE_PLATFORM_WINDOWS)
+  HANDLE file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ,
+                            NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+
+  if (INVALID_HANDLE_VALUE != file) {
+    LARGE_INTEGER file_size;
+
+    if (GetFileSizeEx(file, &file_size) && file_size.QuadPart) {
+      HANDLE mapping =
+          CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+
+      if (mapping) {
+        address = (uint8 *)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+        size = file_size.QuadPart;
+        // Our view keeps the mapping alive.
+        CloseHandle(mapping);
+      }
+    }
+
+    CloseHandle(file);
+  }
+#else
+  int file = open(filename.c_str(), O_RDONLY);
+
+  if (file >= 0) {
+    struct stat file_stat;
+
+    if (!fstat(file, &file_stat) && file_stat.st_size) {
+      void *mapping = mmap(nullptr, file_stat.st_size, PROT_READ, MAP_SHARED,
+                           file, 0);
+
+      if (MAP_FAILED != mapping) {
+        address = (uint8 *)mapping;
+        size = file_stat.st_size;
+      }
+    }
+
+    // Our mapping keeps the file alive.
+    close(file);
+  }
+#endif
+
+  if (!address) {
+    if (error) {
+      *error = "Failed to map dataset file.";
+    }
+    return false;
+  }
+
+  map_address_ = address;
+  map_size_ = size;
+
+  DatasetFileHeader header;
+
+  if (size < kDatasetAlignment) {
+    Unmap();
+    if (error) {
+      *error = "Invalid dataset file detected.";
+    }
+    return false;
+  }
+
+  memcpy(&header, address, sizeof(header));
+
+  if (kDatasetFileMagic != header.magic ||
+      kDatasetFileVersion != header.version) {
+    Unmap();
+    if (error) {
+      *error = "Unsupported dataset file version.";
+    }
+    return false;
+  }
+
+  if (!SetLayout(header.image_count, header.width, header.height,
+                 header.border, error)) {
+    Unmap();
+    return false;
+  }
+
+  uint64 image_slab_size = uint64(image_stride_) * image_count_;
+  uint64 label_slab_size = uint64(label_stride_) * image_count_;
+
+  if (size < kDatasetAlignment + image_slab_size + label_slab_size +
+                 sizeof(uint32) * uint64(image_count_)) {
+    Unmap();
+    if (error) {
+      *error = "Dataset file is truncated.";
+    }
+    return false;
+  }
+
+  image_data_ = address + kDatasetAlignment;
+  label_data_ = image_data_ + image_slab_size;
+
+  const uint32 *codices = (const uint32 *)(label_data_ + label_slab_size);
+  codices_.assign(codices, codices + image_count_);
+
+  if (label_count) {
+    *label_count = header.label_count;
+  }
+
+  return true;
+}
+
+void Dataset::Unmap() {
+  if (!map_address_) {
+    return;
+  }
+
+#if defined(BASE_PLATFORM_WINDOWS)
+  UnmapViewOfFile(map_address_);
+#else
+  munmap(map_address_, map_size_);
+#endif
+
+  map_address_ = nullptr;
+  map_size_ = 0;
+  image_data_ = nullptr;
+  label_data_ = nullptr;
+  image_count_ = 0;
+  codices_.clear();
+}
+
+// Asks the operating system to begin reading a range of a mapped file.
+void PrefetchMappedRange(const uint8 *address, uint64 size) {
+  if (!size) {
+    return;
+  }
+
+#if defined(BASE_PLATFORM_WINDOWS)
+#if defined(_WIN32_WINNT_WIN8) && _WIN32_WINNT >= _WIN32_WINNT_WIN8
+  WIN32_MEMORY_RANGE_ENTRY range = {(PVOID)address, (SIZE_T)size};
+  PrefetchVirtualMemory(GetCurrentProcess(), 1, &range, 0);
+#endif
+#else
+  // Advice must begin on a page boundary.
+  uintptr_t page_size = sysconf(_SC_PAGESIZE);
+  uintptr_t start = reinterpret_cast<uintptr_t>(address) & ~(page_size - 1);
+  uintptr_t end = reinterpret_cast<uintptr_t>(address) + size;
+  madvise(reinterpret_cast<void *>(start), end - start, MADV_WILLNEED);
+#endif
+}
+
+void Dataset::PrefetchImages(uint32 start, uint32 count) const {
+  if (!map_address_ || !image_count_) {
+    return;
+  }
+
+  start %= image_count_;
+  count = count > image_count_ ? image_count_ : count;
+
+  // Our range may wrap around to the start of the set.
+  uint32 first_count = count > image_count_ - start ? image_count_ - start
+                                                    : count;
+  uint32 ranges[2][2] = {{start, first_count}, {0, count - first_count}};
+
+  for (uint32 i = 0; i < 2; i++) {
+    PrefetchMappedRange(image_data_ + uint64(ranges[i][0]) * image_stride_,
+                        uint64(ranges[i][1]) * image_stride_);
+    PrefetchMappedRange(label_data_ + uint64(ranges[i][0]) * label_stride_,
+                        uint64(ranges[i][1]) * label_stride_);
+  }
+}
+
+bool Dataset::IsBorderSufficient(uint32 search_radius) const {
+  // Probe offsets are limited to half of each dimension (see ProjectCoord).
+  uint32 reach_x = search_radius < (width_ >> 1) ? search_radius : width_ >> 1;
+  uint32 reach_y =
+      search_radius < (height_ >> 1) ? search_radius : height_ >> 1;
+
+  return border_ >= reach_x && border_ >= reach_y;
+}
+
+void Dataset::GetImageSet(uint32 index, ImageSet *output) const {
+  output->image.Initialize(width_, height_);
+  output->label.Initialize(width_, height_);
+  output->codex = codices_[index];
+
+  for (uint32 y = 0; y < height_; y++) {
+    memcpy(&output->image.data[y * width_],
+           GetImageData(index) + y * row_stride_, width_);
+  }
+
+  memcpy(output->label.data.data(), GetLabelData(index), width_ * height_);
+}
+
+void Dataset::SetImage(uint32 index, const uint8 *data) {
+  if (map_address_) {
+    return;
+  }
+
+  uint8 *image = image_data_ + size_t(index) * image_stride_ + image_origin_;
+  int32 border = border_;
+  int32 row_stride = row_stride_;
+  int32 width = width_;
+  int32 height = height_;
+
+  // Copy each row and mirror its left and right borders.
+  for (int32 y = 0; y < height; y++) {
+    uint8 *row = image + y * row_stride;
+    memcpy(row, data + y * width, width);
+
+    for (int32 x = -border; x < 0; x++) {
+      row[x] = row[MirrorCoord(x, width)];
+    }
+
+    for (int32 x = width; x < width + border; x++) {
+      row[x] = row[MirrorCoord(x, width)];
+    }
+  }
+
+  // Mirror entire rows (including their borders) into the top and bottom
+  // borders.
+  for (int32 y = -border; y < 0; y++) {
+    memcpy(image + y * row_stride - border,
+           image + MirrorCoord(y, height) * row_stride - border, row_stride);
+  }
+
+  for (int32 y = height; y < height + border; y++) {
+    memcpy(image + y * row_stride - border,
+           image + MirrorCoord(y, height) * row_stride - border, row_stride);
+  }
+}
+
+void Dataset::SetLabels(uint32 index, const uint8 *labels) {
+  if (map_address_) {
+    return;
+  }
+
+  memcpy(label_data_ + size_t(index) * label_stride_, labels,
+         width_ * height_);
+}
+
+DatasetWriter::DatasetWriter()
+    : image_count_(0), written_count_(0), label_offset_(0), codex_offset_(0) {}
+
+bool DatasetWriter::Open(const string &filename, uint32 image_count,
+                         uint32 width, uint32 height, uint32 border,
+                         string *error) {
+  if (!image_.Initialize(1, width, height, border, error)) {
+    return false;
+  }
+
+  out_stream_.open(filename, ::std::ios::out | ::std::ios::binary);
+
+  if (!out_stream_) {
+    if (error) {
+      *error = "Failed to create dataset file.";
+    }
+    return false;
+  }
+
+  image_count_ = image_count;
+  written_count_ = 0;
+  label_offset_ =
+      kDatasetAlignment + uint64(image_.image_stride_) * image_count;
+  codex_offset_ = label_offset_ + uint64(image_.label_stride_) * image_count;
+
+  return true;
+}
+
+bool DatasetWriter::WriteImage(const uint8 *image, const uint8 *labels,
+                               uint32 codex, string *error) {
+  if (!image || !labels || written_count_ >= image_count_) {
+    if (error) {
+      *error = "Invalid parameter(s) specified to DatasetWriter::WriteImage.";
+    }
+    return false;
+  }
+
+  uint64 index = written_count_;
+  image_.SetImage(0, image);
+  image_.SetLabels(0, labels);
+
+  if (!out_stream_.seekp(kDatasetAlignment + index * image_.image_stride_) ||
+      !out_stream_.write((char *)image_.image_data_, image_.image_stride_) ||
+      !out_stream_.seekp(label_offset_ + index * image_.label_stride_) ||
+      !out_stream_.write((char *)image_.label_data_, image_.label_stride_) ||
+      !out_stream_.seekp(codex_offset_ + index * sizeof(uint32)) ||
+      !out_stream_.write((char *)&codex, sizeof(uint32))) {
+    if (error) {
+      *error = "Failed to write image to dataset file.";
+    }
+    return false;
+  }
+
+  written_count_++;
+  return true;
+}
+
+bool DatasetWriter::Close(uint32 label_count, string *error) {
+  if (written_count_ != image_count_) {
+    if (error) {
+      *error = "Dataset file is missing images.";
+    }
+    return false;
+  }
+
+  DatasetFileHeader header = {kDatasetFileMagic,    kDatasetFileVersion,
+                              image_count_,         image_.width_,
+                              image_.height_,       image_.border_,
+                              label_count};
+  uint8 header_block[kDatasetAlignment] = {0};
+  memcpy(header_block, &header, sizeof(header));
+
+  if (!out_stream_.seekp(0) ||
+      !out_stream_.write((char *)header_block, sizeof(header_block))) {
+    if (error) {
+      *error = "Failed to write dataset file header.";
+    }
+    return false;
+  }
+
+  out_stream_.close();
+  return true;
+}
+
+}  // namespace base
\ No newline at end of file
@@ -0,0 +1,232 @@
+/*
+//
+// Copyright (c) 1998-2019 Joe Bertolami. All Right Reserved.
+//
+//   Redistribution and use in source and binary forms, with or without
+//   modification, are permitted provided that the following conditions are met:
+//
+//   * Redistributions of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//
+//   * Redistributions in binary form must reproduce the above copyright notice,
+//     this list of conditions and the following disclaimer in the documentation
+//     and/or other materials provided with the distribution.
+//
+//   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+//   AND ANY EXPRESS OR IMPLIED WARRANTIES, CLUDG, BUT NOT LIMITED TO, THE
+//   IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+//   ARE DISCLAIMED.  NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+//   LIABLE FOR ANY DIRECT, DIRECT, CIDENTAL, SPECIAL, EXEMPLARY, OR
+//   CONSEQUENTIAL DAMAGES (CLUDG, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+//   GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSESS TERRUPTION)
+//   HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER  CONTRACT, STRICT
+//   LIABILITY, OR TORT (CLUDG NEGLIGENCE OR OTHERWISE) ARISG  ANY WAY  OF THE
+//   USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// Additional Information:
+//
+//   For more information, visit http://www.bertolami.com.
+//
+*/
+
+#ifndef __DATASET_H__
+#define __DATASET_H__
+
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <new>
+#include <vector>
+
+#include "base_types.h"
+#include "image.h"
+
+using ::std::ofstream;
+using ::std::vector;
+
+namespace base {
+
+// The alignment, in bytes, of each image within a dataset.
+const uint32 kDatasetAlignment = 64;
+
+// Dataset files begin with this magic number and a format version.
+const uint32 kDatasetFileMagic = 0x53444452;  // "RDDS"
+const uint32 kDatasetFileVersion = 1;
+
+// Allocates storage aligned to kDatasetAlignment bytes. The original
+// allocation is stored just before the aligned block.
+template <typename T>
+struct AlignedAllocator {
+  typedef T value_type;
+
+  AlignedAllocator() {}
+  template <typename U>
+  AlignedAllocator(const AlignedAllocator<U> &) {}
+
+  T *allocate(size_t count) {
+    uint8 *base = static_cast<uint8 *>(::operator new(
+        count * sizeof(T) + kDatasetAlignment + sizeof(void *)));
+    uintptr_t aligned = (reinterpret_cast<uintptr_t>(base) + sizeof(void *) +
+                         kDatasetAlignment - 1) &
+                        ~static_cast<uintptr_t>(kDatasetAlignment - 1);
+    reinterpret_cast<void **>(aligned)[-1] = base;
+    return reinterpret_cast<T *>(aligned);
+  }
+
+  void deallocate(T *pointer, size_t /*count*/) {
+    ::operator delete(reinterpret_cast<void **>(pointer)[-1]);
+  }
+};
+
+template <typename T, typename U>
+bool operator==(const AlignedAllocator<T> &, const AlignedAllocator<U> &) {
+  return true;
+}
+
+template <typename T, typename U>
+bool operator!=(const AlignedAllocator<T> &, const AlignedAllocator<U> &) {
+  return false;
+}
+
+// A set of equally sized images and their per-pixel labels, stored as two
+// contiguous slabs (one for images, one for labels). Each image occupies a
+// fixed, aligned stride within its slab, so any pixel of any image is
+// addressed directly by (image index, x, y).
+//
+// Images may carry a border of mirrored pixels, reflected exactly as
+// ProjectCoord reflects out of bounds probes. Split functions whose offsets
+// fit within the border may then probe pixels with direct loads.
+//
+// A dataset may also be mapped, read only, from a dataset file (see
+// DatasetWriter), in which case its slabs are paged in from disk as they
+// are accessed, so the images and labels need not fit in memory. Training
+// still holds 8 bytes per sample (pixel) of each tree's training images
+// (see DecisionTree::Train), so those sample ids, for every tree trained
+// concurrently, must fit in memory.
+class Dataset {
+ public:
+  Dataset();
+  ~Dataset();
+  Dataset(const Dataset &) = delete;
+  Dataset &operator=(const Dataset &) = delete;
+  // Allocates space for image_count images (and labels) of the specified
+  // dimensions, with a mirrored border of the specified width around each
+  // image. Probe offsets never exceed half of an image dimension, so wider
+  // borders are reduced to that. Pixel, label and codex values are zero
+  // initialized.
+  bool Initialize(uint32 image_count, uint32 width, uint32 height,
+                  uint32 border, string *error = nullptr);
+  // Maps a dataset file into memory, replacing any current contents, and
+  // retrieves the number of distinct labels that it was written with.
+  // Mapped datasets must not be modified.
+  bool Map(const string &filename, uint32 *label_count,
+           string *error = nullptr);
+  // Hints that images [start, start + count), wrapping around the set, are
+  // about to be read. Mapped datasets begin reading them from disk.
+  void PrefetchImages(uint32 start, uint32 count) const;
+  // Returns the number of images in the set.
+  uint32 GetImageCount() const { return image_count_; }
+  // Returns the dimensions shared by every image in the set.
+  uint32 GetWidth() const { return width_; }
+  uint32 GetHeight() const { return height_; }
+  // Returns the width of the mirrored border around each image.
+  uint32 GetBorder() const { return border_; }
+  // Returns true if the border covers every probe of a split function with
+  // the specified search radius.
+  bool IsBorderSufficient(uint32 search_radius) const;
+  // Returns the distance, in bytes, between consecutive rows of an image.
+  uint32 GetRowStride() const { return row_stride_; }
+  // Returns pixel <0,0> of an image, stored in row-major order with rows
+  // GetRowStride() bytes apart. Border pixels precede and follow each row.
+  const uint8 *GetImageData(uint32 index) const {
+    return image_data_ + size_t(index) * image_stride_ + image_origin_;
+  }
+  // Copies a width * height image into the set and mirrors its border.
+  // Mapped datasets are read only and are left unchanged.
+  void SetImage(uint32 index, const uint8 *data);
+  // Copies the width * height per-pixel labels of an image into the set.
+  // Mapped datasets are read only and are left unchanged.
+  void SetLabels(uint32 index, const uint8 *labels);
+  // Returns the per-pixel labels of an image, stored in row-major order
+  // (without a border).
+  const uint8 *GetLabelData(uint32 index) const {
+    return label_data_ + size_t(index) * label_stride_;
+  }
+  // Returns the value of pixel <x,y> within an image.
+  uint8 GetPixel(uint32 index, uint32 x, uint32 y) const {
+    return GetImageData(index)[y * row_stride_ + x];
+  }
+  // Returns the label of pixel <x,y> within an image.
+  uint8 GetLabel(uint32 index, uint32 x, uint32 y) const {
+    return GetLabelData(index)[y * width_ + x];
+  }
+  // Returns the dominant class of an image.
+  uint32 GetCodex(uint32 index) const { return codices_[index]; }
+  // Sets the dominant class of an image.
+  void SetCodex(uint32 index, uint32 codex) { codices_[index] = codex; }
+  // Copies an image, its labels and its codex out of the set.
+  void GetImageSet(uint32 index, ImageSet *output) const;
+
+ private:
+  // Computes our dimensions and strides, without allocating storage.
+  bool SetLayout(uint32 image_count, uint32 width, uint32 height,
+                 uint32 border, string *error);
+  // Releases a mapped dataset file.
+  void Unmap();
+
+  uint32 image_count_;
+  uint32 width_;
+  uint32 height_;
+  uint32 border_;
+  uint32 row_stride_;
+  // The distance, in bytes, between consecutive images in each slab.
+  uint32 image_stride_;
+  uint32 label_stride_;
+  // The offset of pixel <0,0> from the start of its image.
+  uint32 image_origin_;
+  vector<uint8, AlignedAllocator<uint8>> image_slab_;
+  vector<uint8, AlignedAllocator<uint8>> label_slab_;
+  vector<uint32> codices_;
+  // The start of our image and label slabs, which are either allocated
+  // above or mapped from a dataset file.
+  uint8 *image_data_;
+  uint8 *label_data_;
+  // The address and size of our mapped dataset file, if any.
+  void *map_address_;
+  uint64 map_size_;
+  // Writers pad images with a single image dataset.
+  friend class DatasetWriter;
+};
+
+// Writes a dataset file that may be mapped by Dataset::Map. Images are
+// padded and written one at a time, so that datasets larger than memory
+// may be prepared.
+class DatasetWriter {
+ public:
+  DatasetWriter();
+  // Creates filename for image_count images of the specified dimensions,
+  // with a mirrored border of the specified width (see Dataset::Initialize).
+  bool Open(const string &filename, uint32 image_count, uint32 width,
+            uint32 height, uint32 border, string *error = nullptr);
+  // Pads and writes the next width * height image, along with its
+  // per-pixel labels and codex.
+  bool WriteImage(const uint8 *image, const uint8 *labels, uint32 codex,
+                  string *error = nullptr);
+  // Records the number of distinct labels in the set and completes the
+  // file. Every image must have been written.
+  bool Close(uint32 label_count, string *error = nullptr);
+
+ private:
+  ofstream out_stream_;
+  // Holds the image currently being padded.
+  Dataset image_;
+  uint32 image_count_;
+  uint32 written_count_;
+  // The file offsets of our label slab and codices.
+  uint64 label_offset_;
+  uint64 codex_offset_;
+};
+
+}  // namespace base
+
+#endif  // __DATASET_H__
\ No newline at end of file
@@ -0,0 +1,190 @@
+#include "evaluator.h"
+
+#if defined(__AVX2__)
+#define ENABLE_AVX2 (1)
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64) || \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define ENABLE_SSE2 (1)
+#include <emmintrin.h>
+#endif
+
+namespace base {
+
+// Adds the 0/1 byte flags in left to the kSplitBatchSize counters at totals.
+inline void AccumulateLeftFlags(const uint8 *left, uint32 *totals) {
+#if ENABLE_AVX2
+  __m128i flags = _mm_loadu_si128((const __m128i *)left);
+  __m256i low = _mm256_cvtepu8_epi32(flags);
+  __m256i high = _mm256_cvtepu8_epi32(_mm_srli_si128(flags, 8));
+  __m256i *target = (__m256i *)totals;
+  _mm256_storeu_si256(target, _mm256_add_epi32(_mm256_loadu_si256(target), low));
+  _mm256_storeu_si256(target + 1,
+                      _mm256_add_epi32(_mm256_loadu_si256(target + 1), high));
+#elif ENABLE_SSE2
+  __m128i zero = _mm_setzero_si128();
+  __m128i flags = _mm_loadu_si128((const __m128i *)left);
+  __m128i words[2] = {_mm_unpacklo_epi8(flags, zero),
+                      _mm_unpackhi_epi8(flags, zero)};
+  __m128i *target = (__m128i *)totals;
+  for (uint32 i = 0; i < 2; i++) {
+    __m128i low = _mm_unpacklo_epi16(words[i], zero);
+    __m128i high = _mm_unpackhi_epi16(words[i], zero);
+    _mm_storeu_si128(target, _mm_add_epi32(_mm_loadu_si128(target), low));
+    _mm_storeu_si128(target + 1,
+                     _mm_add_epi32(_mm_loadu_si128(target + 1), high));
+    target += 2;
+  }
+#else
+  for (uint32 i = 0; i < kSplitBatchSize; i++) {
+    totals[i] += left[i];
+  }
+#endif
+}
+
+// Sets left[i] to 1 where value1[i] <= value0[i] (i.e. the split function
+// sends the sample left) and to 0 otherwise.
+inline void CompareProbes(const uint8 *value0, const uint8 *value1,
+                          uint8 *left) {
+#if ENABLE_AVX2 || ENABLE_SSE2
+  __m128i v0 = _mm_loadu_si128((const __m128i *)value0);
+  __m128i v1 = _mm_loadu_si128((const __m128i *)value1);
+  // Unsigned v1 <= v0 is equivalent to max(v0, v1) == v0.
+  __m128i mask = _mm_cmpeq_epi8(_mm_max_epu8(v0, v1), v0);
+  _mm_storeu_si128((__m128i *)left, _mm_and_si128(mask, _mm_set1_epi8(1)));
+#else
+  for (uint32 i = 0; i < kSplitBatchSize; i++) {
+    left[i] = value1[i] <= value0[i];
+  }
+#endif
+}
+
+void SplitEvaluator::Initialize(uint32 class_count, const TrainSet *train_set,
+                                bool learn_thresholds) {
+  class_count_ = class_count;
+  train_set_ = train_set;
+  function_count_ = 0;
+  learn_thresholds_ = learn_thresholds;
+
+  if (learn_thresholds) {
+    bin_totals_.resize(kSplitBatchSize * kSplitDifferenceBinCount);
+    difference_totals_.resize(bin_totals_.size() * class_count);
+  } else {
+    left_totals_.resize(class_count * kSplitBatchSize);
+  }
+}
+
+bool SplitEvaluator::SetFunctions(const SplitFunction *functions,
+                                  uint32 function_count, string *error) {
+  if (!functions || !function_count || function_count > kSplitBatchSize) {
+    if (error) {
+      *error =
+          "Invalid parameter(s) specified to SplitEvaluator::SetFunctions.";
+    }
+    return false;
+  }
+
+  function_count_ = function_count;
+  memset(padded_offsets_, 0, sizeof(padded_offsets_));
+
+  for (uint32 k = 0; k < function_count; k++) {
+    functions[k].GetProbeOffsets(&offsets_[0][k], &offsets_[1][k]);
+    functions[k].GetPaddedProbeOffsets(
+        train_set_->width, train_set_->height, train_set_->row_stride,
+        &padded_offsets_[0][k], &padded_offsets_[1][k]);
+  }
+
+  if (learn_thresholds_) {
+    // Only the bins of bound functions are cleared.
+    memset(bin_totals_.data(), 0,
+           sizeof(uint32) * function_count * kSplitDifferenceBinCount);
+    memset(difference_totals_.data(), 0,
+           sizeof(uint32) * function_count * kSplitDifferenceBinCount *
+               class_count_);
+  } else {
+    memset(left_totals_.data(), 0, sizeof(uint32) * left_totals_.size());
+  }
+
+  return true;
+}
+
+void SplitEvaluator::AddSample(uint32 sample) {
+  uint8 sample_label = train_set_->GetLabel(sample);
+
+  if (sample_label >= class_count_) {
+    return;
+  }
+
+  // Gather the probe pixels for every candidate (unused lanes compare
+  // equal and are ignored), then compare them all at once.
+  uint8 value0[kSplitBatchSize] = {0};
+  uint8 value1[kSplitBatchSize] = {0};
+  uint8 left[kSplitBatchSize];
+
+  if (train_set_->is_padded) {
+    // Every probe lies within the image or its mirrored border.
+    const uint8 *pixel = train_set_->GetSampleData(sample);
+
+    for (uint32 k = 0; k < kSplitBatchSize; k++) {
+      value0[k] = pixel[padded_offsets_[0][k]];
+      value1[k] = pixel[padded_offsets_[1][k]];
+    }
+  } else {
+    SplitCoord coord = train_set_->GetCoord(sample);
+    const uint8 *image = train_set_->GetImageData(sample);
+    uint32 width = train_set_->width;
+    uint32 height = train_set_->height;
+    uint32 row_stride = train_set_->row_stride;
+
+    for (uint32 k = 0; k < function_count_; k++) {
+      SplitCoord probe0 = ProjectCoord(width, height, coord, offsets_[0][k]);
+      SplitCoord probe1 = ProjectCoord(width, height, coord, offsets_[1][k]);
+      value0[k] = image[probe0.y * row_stride + probe0.x];
+      value1[k] = image[probe1.y * row_stride + probe1.x];
+    }
+  }
+
+  if (learn_thresholds_) {
+    for (uint32 k = 0; k < function_count_; k++) {
+      uint32 bin = kMaxSplitDifference + value1[k] - value0[k];
+      uint32 bin_index = k * kSplitDifferenceBinCount + bin;
+      bin_totals_[bin_index]++;
+      difference_totals_[bin_index * class_count_ + sample_label]++;
+    }
+    return;
+  }
+
+  CompareProbes(value0, value1, left);
+  AccumulateLeftFlags(left, &left_totals_[sample_label * kSplitBatchSize]);
+}
+
+void SplitEvaluator::AddSamples(const uint32 *samples, uint32 sample_count) {
+  for (uint32 j = 0; j < sample_count; j++) {
+    AddSample(samples[j]);
+  }
+}
+
+void SplitEvaluator::GetLeftHistogram(uint32 function_index,
+                                      Histogram *output) const {
+  output->Initialize(class_count_);
+
+  for (uint32 i = 0; i < class_count_; i++) {
+    output->IncrementValue(i,
+                           left_totals_[i * kSplitBatchSize + function_index]);
+  }
+}
+
+void SplitEvaluator::AddDifferenceBin(uint32 function_index, uint32 bin,
+                                      Histogram *output) const {
+  const uint32 *totals =
+      &difference_totals_[(function_index * kSplitDifferenceBinCount + bin) *
+                          class_count_];
+
+  for (uint32 i = 0; i < class_count_; i++) {
+    if (totals[i]) {
+      output->IncrementValue(i, totals[i]);
+    }
+  }
+}
+
+}  // namespace base
\ No newline at end of file
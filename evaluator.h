@@ -0,0 +1,104 @@
+/*
+//
+// Copyright (c) 1998-2019 Joe Bertolami. All Right Reserved.
+//
+//   Redistribution and use in source and binary forms, with or without
+//   modification, are permitted provided that the following conditions are met:
+//
+//   * Redistributions of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//
+//   * Redistributions in binary form must reproduce the above copyright notice,
+//     this list of conditions and the following disclaimer in the documentation
+//     and/or other materials provided with the distribution.
+//
+//   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+//   AND ANY EXPRESS OR IMPLIED WARRANTIES, CLUDG, BUT NOT LIMITED TO, THE
+//   IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+//   ARE DISCLAIMED.  NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+//   LIABLE FOR ANY DIRECT, DIRECT, CIDENTAL, SPECIAL, EXEMPLARY, OR
+//   CONSEQUENTIAL DAMAGES (CLUDG, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+//   GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSESS TERRUPTION)
+//   HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER  CONTRACT, STRICT
+//   LIABILITY, OR TORT (CLUDG NEGLIGENCE OR OTHERWISE) ARISG  ANY WAY  OF THE
+//   USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// Additional Information:
+//
+//   For more information, visit http://www.bertolami.com.
+//
+*/
+
+#ifndef __EVALUATOR_H__
+#define __EVALUATOR_H__
+
+#include <vector>
+
+#include "base_types.h"
+#include "histogram.h"
+#include "split.h"
+#include "tree.h"
+
+using ::std::vector;
+
+namespace base {
+
+// The number of candidate split functions evaluated per pass over the data.
+const uint32 kSplitBatchSize = 16;
+
+// Evaluates a block of candidate split functions in a single, sample-major
+// pass over a sample set. Each sample's probe pixels are fetched for every
+// candidate before moving on to the next sample, so samples are streamed
+// through the cache once per block rather than once per candidate.
+class SplitEvaluator {
+ public:
+  // Initializes the evaluator for a specific class count and the training
+  // data that sample ids refer to. If learn_thresholds is set, samples are
+  // tallied by their probe difference (see GetDifferenceTotal) so that a
+  // threshold may be chosen for each function. Otherwise, they are tallied
+  // for a threshold of zero (see GetLeftHistogram).
+  void Initialize(uint32 class_count, const TrainSet *train_set,
+                  bool learn_thresholds = false);
+  // Binds function_count (<= kSplitBatchSize) candidate functions and
+  // clears the totals of any previous evaluation.
+  bool SetFunctions(const SplitFunction *functions, uint32 function_count,
+                    string *error = nullptr);
+  // Tallies the label of a sample for each bound function.
+  void AddSample(uint32 sample);
+  // Tallies a contiguous range of samples.
+  void AddSamples(const uint32 *samples, uint32 sample_count);
+  // Retrieves the left histogram of a bound function.
+  void GetLeftHistogram(uint32 function_index, Histogram *output) const;
+  // Queries the number of samples whose probe difference under a bound
+  // function is bin - kMaxSplitDifference. Requires learn_thresholds.
+  uint32 GetDifferenceTotal(uint32 function_index, uint32 bin) const {
+    return bin_totals_[function_index * kSplitDifferenceBinCount + bin];
+  }
+  // Adds the class totals of a difference bin to output. Requires
+  // learn_thresholds.
+  void AddDifferenceBin(uint32 function_index, uint32 bin,
+                        Histogram *output) const;
+
+ private:
+  uint32 class_count_;
+  uint32 function_count_;
+  bool learn_thresholds_;
+  const TrainSet *train_set_;
+  // The probe offsets of each bound function (see GetProbeOffsets).
+  SplitCoord offsets_[2][kSplitBatchSize];
+  // The probe offsets in bytes, used when our images are padded (see
+  // GetPaddedProbeOffsets). Unused lanes probe the sample itself.
+  int32 padded_offsets_[2][kSplitBatchSize];
+  // Per-class left totals, stored class-major so that a single sample
+  // updates kSplitBatchSize contiguous counters.
+  vector<uint32> left_totals_;
+  // Per-class totals of each function's difference bins, indexed by
+  // (function * kSplitDifferenceBinCount + bin) * class_count + class, and
+  // the sample total of each bin. Only used when learning thresholds.
+  vector<uint32> difference_totals_;
+  vector<uint32> bin_totals_;
+};
+
+}  // namespace base
+
+#endif  // __EVALUATOR_H__
\ No newline at end of file
@@ -1,9 +1,12 @@
 
 #include "forest.h"
 #include "numeric.h"
-#include "random.h"
+#include "scheduler.h"
 
 #include <time.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <thread>
 
 #if _DEBUG
@@ -14,40 +17,130 @@
 
 namespace base {
 
-uint64 GetTrainingSeed() {
-#if defined(BASE_PLATFORM_WINDOWS)
-  uint64 result = 0;
-  SYSTEMTIME sys_time;
-  GetSystemTime(&sys_time);
-  result |= sys_time.wHour;
-  result <<= 16;
-  result |= sys_time.wMinute;
-  result <<= 16;
-  result |= sys_time.wSecond;
-  result <<= 16;
-  result |= sys_time.wMilliseconds;
-  result <<= 16;
-  return result;
-#elif defined(BASE_PLATFORM_MACOSX)
-  timeval time;
-  gettimeofday(&time, NULL);
-  return (time.tv_sec * 1000) + (time.tv_usec / 1000);
-#endif
+// Selects a master seed for forests whose params do not specify one.
+uint32 GetTrainingSeed() {
+  uint64 time = ::std::chrono::system_clock::now().time_since_epoch().count();
+  uint32 seed = static_cast<uint32>(time ^ (time >> 32));
+  return seed ? seed : 1;
+}
+
+typedef ::std::chrono::steady_clock::time_point TrainingClock;
+
+float32 GetSecondsSince(const TrainingClock& start_time) {
+  return ::std::chrono::duration<float32>(::std::chrono::steady_clock::now() -
+                                          start_time)
+      .count();
 }
 
-void TrainTreeFunction(DecisionTree* tree,
+// Copies an image into a single image dataset with a mirrored border, so
+// that our trees may probe it without projecting coordinates.
+bool PadInputImage(const Image& input, uint32 border, Dataset* output,
+                   string* error) {
+  if (input.data.size() != input.width * input.height) {
+    if (error) {
+      *error = "Invalid input image specified for classification.";
+    }
+    return false;
+  }
+
+  if (!output->Initialize(1, input.width, input.height, border, error)) {
+    return false;
+  }
+
+  output->SetImage(0, input.data.data());
+  return true;
+}
+
+bool TrainTreeFunction(DecisionTree* tree,
                        const DecisionTreeParams& tree_params,
-                       vector<ImageSet>* training_data, uint32 train_start,
-                       uint32 train_count) {
-  set_seed(GetTrainingSeed());
+                       const Dataset* training_data, uint32 train_start,
+                       uint32 train_count, uint64 random_seed,
+                       TaskScheduler* scheduler,
+                       const TrainingClock& forest_start_time,
+                       TreeTrainingTime* tree_time, string* error) {
+  tree_time->start_time = GetSecondsSince(forest_start_time);
+  bool result = tree->Train(tree_params, training_data, train_start,
+                            train_count, random_seed, scheduler, error);
+  tree_time->finish_time = GetSecondsSince(forest_start_time);
 
-  tree->Train(tree_params, training_data, train_start, train_count);
+  return result;
 }
 
 bool DecisionForest::Train(const DecisionForestParams& forest_params,
                            const DecisionTreeParams& tree_params,
-                           vector<ImageSet>* training_data, string* error) {
-  if (!training_data || !training_data->size()) {
+                           const Dataset* training_data, string* error) {
+  DecisionForestParams complete_params = forest_params;
+
+  complete_params.shard_tree_start = 0;
+  complete_params.shard_tree_count = 0;
+
+  return TrainTrees(complete_params, tree_params, training_data, 0,
+                    forest_params.total_tree_count, error);
+}
+
+bool DecisionForest::TrainShard(const DecisionForestParams& forest_params,
+                                const DecisionTreeParams& tree_params,
+                                const Dataset* training_data,
+                                uint32 shard_index, uint32 shard_count,
+                                string* error) {
+  if (!forest_params.random_seed || shard_index >= shard_count ||
+      shard_count > forest_params.total_tree_count) {
+    if (error) {
+      *error = "Invalid parameter(s) specified to DecisionForest::TrainShard.";
+    }
+    return false;
+  }
+
+  // Trees are divided as evenly as possible, so that shards take roughly
+  // the same time to train.
+  uint64 total_tree_count = forest_params.total_tree_count;
+  uint32 first_tree = (shard_index * total_tree_count) / shard_count;
+  uint32 end_tree = ((shard_index + 1) * total_tree_count) / shard_count;
+  DecisionForestParams shard_params = forest_params;
+
+  shard_params.shard_tree_start = first_tree;
+  shard_params.shard_tree_count = end_tree - first_tree;
+
+  return TrainTrees(shard_params, tree_params, training_data, first_tree,
+                    end_tree - first_tree, error);
+}
+
+bool DecisionForest::Grow(uint32 tree_count, const Dataset* training_data,
+                          string* error) {
+  if (!tree_count || decision_forest_.empty() ||
+      forest_params_.shard_tree_count) {
+    if (error) {
+      *error = "Invalid parameter(s) specified to DecisionForest::Grow.";
+    }
+    return false;
+  }
+
+  // Our new trees continue the sequence of tree indices, and are spread
+  // across the training data as if the forest had been trained at its
+  // grown size.
+  DecisionForestParams previous_params = forest_params_;
+  DecisionForestParams grown_params = forest_params_;
+  uint32 first_tree = decision_forest_.size();
+
+  grown_params.total_tree_count = first_tree + tree_count;
+
+  if (!TrainTrees(grown_params, tree_params_, training_data, first_tree,
+                  tree_count, error)) {
+    // Leave the forest as it was before we began.
+    decision_forest_.resize(first_tree);
+    forest_params_ = previous_params;
+    return false;
+  }
+
+  return true;
+}
+
+bool DecisionForest::TrainTrees(const DecisionForestParams& forest_params,
+                                const DecisionTreeParams& tree_params,
+                                const Dataset* training_data,
+                                uint32 first_tree, uint32 tree_count,
+                                string* error) {
+  if (!training_data || !training_data->GetImageCount()) {
     if (error) {
       *error = "Invalid training data.";
     }
@@ -64,42 +157,102 @@ bool DecisionForest::Train(const DecisionForestParams& forest_params,
 
   tree_params_ = tree_params;
   forest_params_ = forest_params;
-  decision_forest_.resize(forest_params.total_tree_count);
+  compiled_forest_.Clear();
+
+  // Each tree is seeded with our master seed plus its index. We record the
+  // master seed that we used, so that any forest can be reproduced.
+  if (!forest_params_.random_seed) {
+    forest_params_.random_seed = GetTrainingSeed();
+  }
+
+  // Our trees begin with tree shard_tree_start of the complete forest, so
+  // trees before first_tree are retained (see Grow).
+  uint32 first_slot = first_tree - forest_params.shard_tree_start;
+
+  decision_forest_.resize(first_slot + tree_count);
+  tree_training_times_.resize(tree_count);
+
+  TrainingClock start_time = ::std::chrono::steady_clock::now();
 
-  uint32 train_range = training_data->size() / forest_params.total_tree_count;
+  uint32 train_range =
+      training_data->GetImageCount() / forest_params.total_tree_count;
   uint32 train_count =
-      (forest_params.tree_training_percentage * training_data->size()) / 100;
+      (forest_params.tree_training_percentage * training_data->GetImageCount()) /
+      100;
 
 #if ENABLE_MULTITHREADING
-  uint32 thread_count = ::std::thread::hardware_concurrency();
-  uint32 pass_remainder = forest_params.total_tree_count % thread_count;
-  uint32 pass_count =
-      align(forest_params.total_tree_count, thread_count) / thread_count;
+  // Trees are trained by a number of tree slots, each a root task on a pool
+  // of persistent workers that trains one tree after another. Workers start
+  // a slot once they find no node or trial work to steal from the trees
+  // still in training. This thread participates while it waits, so it
+  // counts as one of our threads.
+  uint32 thread_count = forest_params.thread_count;
 
-  for (uint32 pass = 0; pass < pass_count; pass++) {
-    uint32 tree_count = thread_count;
-    vector<::std::thread> thread_list;
+  if (!thread_count) {
+    thread_count = ::std::thread::hardware_concurrency();
+  }
 
-    if (pass == pass_count - 1 && pass_remainder) {
-      tree_count = pass_remainder;
-    }
+  // We train as many trees at once as our memory budget allows, and at
+  // least one. Threads beyond our slot count help train the active trees.
+  uint32 tree_slot_count = tree_count;
+
+  if (forest_params.memory_budget_mb) {
+    uint64 sample_count = uint64(train_count) * training_data->GetWidth() *
+                          training_data->GetHeight();
+    uint64 tree_memory =
+        DecisionTree::EstimateTrainingMemory(tree_params, sample_count);
+    uint64 budget = uint64(forest_params.memory_budget_mb) * 1024 * 1024;
+    uint64 budget_slot_count = tree_memory ? budget / tree_memory : 1;
 
-    for (uint32 i = 0; i < tree_count; i++) {
-      DecisionTree* tree = &decision_forest_.at(pass * thread_count + i);
-      thread_list.emplace_back(&TrainTreeFunction, tree, tree_params_,
-                               training_data, i * train_range, train_count);
+    if (budget_slot_count < tree_slot_count) {
+      tree_slot_count = budget_slot_count ? budget_slot_count : 1;
     }
+  }
+
+  TaskScheduler scheduler;
+  TaskGroup tree_group;
+  ::std::atomic<uint32> next_tree_index(0);
+  vector<string> tree_errors(tree_count);
+  vector<uint8> tree_results(tree_count, 0);
 
-    for (auto& thread_ : thread_list) {
-      thread_.join();
+  if (!scheduler.Initialize(thread_count ? thread_count - 1 : 0, error)) {
+    return false;
+  }
+
+  // Tree i of our range is tree first_tree + i of the complete forest, and
+  // is trained with that tree's seed and training images.
+  for (uint32 slot = 0; slot < tree_slot_count; slot++) {
+    scheduler.SpawnRoot(&tree_group, [&]() {
+      for (uint32 i = next_tree_index++; i < tree_count;
+           i = next_tree_index++) {
+        uint32 tree_index = first_tree + i;
+        tree_results.at(i) = TrainTreeFunction(
+            &decision_forest_.at(first_slot + i), tree_params_, training_data,
+            tree_index * train_range, train_count,
+            forest_params_.random_seed + tree_index, &scheduler, start_time,
+            &tree_training_times_.at(i), &tree_errors.at(i));
+      }
+    });
+  }
+
+  scheduler.Wait(&tree_group);
+
+  for (uint32 i = 0; i < tree_count; i++) {
+    if (!tree_results.at(i)) {
+      if (error) {
+        *error = tree_errors.at(i);
+      }
+      return false;
     }
   }
 #else
-  set_seed(GetTrainingSeed());
-  for (uint32 i = 0; i < forest_params_.total_tree_count; i++) {
-    DecisionTree* tree = &decision_forest_.at(i);
-    if (!tree->Train(tree_params_, training_data, i * train_range, train_count,
-                     error)) {
+  for (uint32 i = 0; i < tree_count; i++) {
+    DecisionTree* tree = &decision_forest_.at(first_slot + i);
+    uint32 tree_index = first_tree + i;
+    if (!TrainTreeFunction(tree, tree_params_, training_data,
+                           tree_index * train_range, train_count,
+                           forest_params_.random_seed + tree_index, nullptr,
+                           start_time, &tree_training_times_.at(i), error)) {
       return false;
     }
   }
@@ -125,21 +278,32 @@ void DecisionForest::ClassifyImage(Image* image_input, Image* label_output,
     return;
   }
 
-  for (uint32 j = 0; j < image_input->height; j++) {
-    for (uint32 i = 0; i < image_input->width; i++) {
-      Histogram result(tree_params_.class_count);
-      for (uint32 k = 0; k < decision_forest_.size(); k++) {
-        // Collect votes from each forest and unify them.
-        Histogram tree_result(tree_params_.class_count);
-        if (!decision_forest_.at(k).ClassifyPixel(i, j, image_input,
-                                                  &tree_result, error)) {
-          return;
-        }
-        // We combine all of the votes from our decision trees into a
-        // single histogram and then use ots dominant value.
-        result += tree_result;
-      }
-      label_output->SetPixel(i, j, result.GetDominantClass());
+  Dataset padded_input;
+
+  if (!PadInputImage(*image_input, tree_params_.visual_search_radius,
+                     &padded_input, error)) {
+    return;
+  }
+
+  if (!PrepareCompiledForest(padded_input, error)) {
+    return;
+  }
+
+  // Pixels are classified in batches, each of which combines the votes of
+  // all of our trees for each of its pixels and then uses their dominant
+  // value.
+  uint8 pixel_classes[kCompiledBatchSize];
+  uint32 width = image_input->width;
+  uint32 pixel_count = width * image_input->height;
+
+  for (uint32 i = 0; i < pixel_count; i += kCompiledBatchSize) {
+    uint32 batch_size = ::std::min(kCompiledBatchSize, pixel_count - i);
+
+    ClassifyPixelBatch(padded_input, 0, i, batch_size, pixel_classes);
+
+    for (uint32 j = 0; j < batch_size; j++) {
+      label_output->SetPixel((i + j) % width, (i + j) / width,
+                             pixel_classes[j]);
     }
   }
 }
@@ -152,6 +316,26 @@ uint8 DecisionForest::Classify(Image* input, string* error) {
     return kBackgroundClassLabel;
   }
 
+  Dataset padded_input;
+
+  if (!PadInputImage(*input, tree_params_.visual_search_radius, &padded_input,
+                     error)) {
+    return kBackgroundClassLabel;
+  }
+
+  return Classify(padded_input, 0, error);
+}
+
+uint8 DecisionForest::Classify(const Dataset& input, uint32 index,
+                               string* error) {
+  if (index >= input.GetImageCount() ||
+      !input.IsBorderSufficient(tree_params_.visual_search_radius)) {
+    if (error) {
+      *error = "Invalid parameter(s) specified to DecisionForest::Classify.";
+    }
+    return kBackgroundClassLabel;
+  }
+
   if (!decision_forest_.size()) {
     if (error) {
       *error = "Decision forest must be trained before it can classify.";
@@ -163,22 +347,22 @@ uint8 DecisionForest::Classify(Image* input, string* error) {
   // class per pixel. Then count up the totals across the image and take the
   // dominant non-background class.
 
+  if (!PrepareCompiledForest(input, error)) {
+    return kBackgroundClassLabel;
+  }
+
+  // Pixels are classified in batches (see ClassifyImage).
   Histogram image_result(tree_params_.class_count);
-  for (uint32 j = 0; j < input->height; j++) {
-    for (uint32 i = 0; i < input->width; i++) {
-      Histogram pixel_result(tree_params_.class_count);
-      for (uint32 k = 0; k < decision_forest_.size(); k++) {
-        // Collect votes from each forest and unify them.
-        Histogram tree_result(tree_params_.class_count);
-        if (!decision_forest_.at(k).ClassifyPixel(i, j, input, &tree_result,
-                                                  error)) {
-          return kBackgroundClassLabel;
-        }
-        // We combine all of the votes from our decision trees into a
-        // single histogram and then use its dominant value.
-        pixel_result += tree_result;
-      }
-      image_result.IncrementValue(pixel_result.GetDominantClass());
+  uint8 pixel_classes[kCompiledBatchSize];
+  uint32 pixel_count = input.GetWidth() * input.GetHeight();
+
+  for (uint32 i = 0; i < pixel_count; i += kCompiledBatchSize) {
+    uint32 batch_size = ::std::min(kCompiledBatchSize, pixel_count - i);
+
+    ClassifyPixelBatch(input, index, i, batch_size, pixel_classes);
+
+    for (uint32 j = 0; j < batch_size; j++) {
+      image_result.IncrementValue(pixel_classes[j]);
     }
   }
   // We ignore background samples which will likely be the most
@@ -188,6 +372,82 @@ uint8 DecisionForest::Classify(Image* input, string* error) {
   return image_result.GetDominantClass();
 }
 
+bool DecisionForest::PrepareCompiledForest(const Dataset& input,
+                                           string* error) {
+  if (!GetCompiledForest(error)) {
+    return false;
+  }
+
+  compiled_forest_.Bind(input.GetWidth(), input.GetHeight(),
+                        input.GetRowStride());
+  return true;
+}
+
+void DecisionForest::ClassifyPixelBatch(const Dataset& input, uint32 index,
+                                        uint32 first_pixel,
+                                        uint32 pixel_count,
+                                        uint8* pixel_classes) {
+  int32 sample_offsets[kCompiledBatchSize];
+  uint32 width = input.GetWidth();
+  uint32 row_stride = input.GetRowStride();
+
+  for (uint32 i = 0; i < pixel_count; i++) {
+    uint32 pixel = first_pixel + i;
+    sample_offsets[i] = (pixel / width) * row_stride + pixel % width;
+  }
+
+  compiled_forest_.ClassifyBatch(input.GetImageData(index), sample_offsets,
+                                 pixel_count, &classify_batch_, pixel_classes);
+}
+
+bool DecisionForest::OptimizeLayout(const Dataset& calibration_data,
+                                    uint32 image_count, string* error) {
+  if (!image_count) {
+    image_count = calibration_data.GetImageCount();
+  }
+
+  if (!image_count || image_count > calibration_data.GetImageCount() ||
+      !calibration_data.IsBorderSufficient(
+          tree_params_.visual_search_radius)) {
+    if (error) {
+      *error = "Invalid parameter(s) specified to "
+               "DecisionForest::OptimizeLayout.";
+    }
+    return false;
+  }
+
+  if (!PrepareCompiledForest(calibration_data, error)) {
+    return false;
+  }
+
+  vector<uint64> visits(2 * compiled_forest_.GetNodeCount(), 0);
+  uint32 row_stride = calibration_data.GetRowStride();
+
+  for (uint32 k = 0; k < image_count; k++) {
+    const uint8* image_data = calibration_data.GetImageData(k);
+
+    for (uint32 j = 0; j < calibration_data.GetHeight(); j++) {
+      for (uint32 i = 0; i < calibration_data.GetWidth(); i++) {
+        compiled_forest_.CountBranches(image_data + j * row_stride + i,
+                                       visits.data());
+      }
+    }
+  }
+
+  compiled_forest_.Reorder(visits);
+  return true;
+}
+
+const CompiledForest* DecisionForest::GetCompiledForest(string* error) {
+  if (compiled_forest_.IsEmpty() &&
+      !compiled_forest_.Compile(decision_forest_, tree_params_.class_count,
+                                error)) {
+    return nullptr;
+  }
+
+  return &compiled_forest_;
+}
+
 DecisionForestParams DecisionForest::GetForestParams() const {
   return forest_params_;
 }
@@ -196,4 +456,97 @@ DecisionTreeParams DecisionForest::GetTreeParams() const {
   return tree_params_;
 }
 
+vector<TreeTrainingTime> DecisionForest::GetTreeTrainingTimes() const {
+  return tree_training_times_;
+}
+
+bool MergeDecisionForests(vector<DecisionForest>* shards,
+                          DecisionForest* output, string* error) {
+  if (!shards || shards->empty() || !output) {
+    if (error) {
+      *error = "Invalid parameter(s) specified to MergeDecisionForests.";
+    }
+    return false;
+  }
+
+  // Order our shards by their first tree. A complete forest begins at tree
+  // zero and holds every tree.
+  vector<DecisionForest*> sorted_shards;
+
+  for (auto& shard : *shards) {
+    sorted_shards.push_back(&shard);
+  }
+
+  ::std::sort(sorted_shards.begin(), sorted_shards.end(),
+              [](const DecisionForest* a, const DecisionForest* b) {
+                return a->forest_params_.shard_tree_start <
+                       b->forest_params_.shard_tree_start;
+              });
+
+  const DecisionForestParams& forest_params =
+      sorted_shards.front()->forest_params_;
+  const DecisionTreeParams& tree_params = sorted_shards.front()->tree_params_;
+  uint32 next_tree = 0;
+
+  for (auto shard : sorted_shards) {
+    const DecisionForestParams& shard_params = shard->forest_params_;
+
+    if (shard_params.total_tree_count != forest_params.total_tree_count ||
+        shard_params.tree_training_percentage !=
+            forest_params.tree_training_percentage ||
+        shard_params.random_seed != forest_params.random_seed ||
+        memcmp(&shard->tree_params_, &tree_params,
+               sizeof(DecisionTreeParams))) {
+      if (error) {
+        *error = "Decision forest shards were trained with different params.";
+      }
+      return false;
+    }
+
+    uint32 shard_tree_count = shard_params.shard_tree_count
+                                  ? shard_params.shard_tree_count
+                                  : shard_params.total_tree_count;
+
+    if (shard_params.shard_tree_start != next_tree ||
+        shard->decision_forest_.size() != shard_tree_count) {
+      if (error) {
+        *error = "Decision forest shards do not hold every tree exactly once.";
+      }
+      return false;
+    }
+
+    next_tree += shard_tree_count;
+  }
+
+  if (next_tree != forest_params.total_tree_count) {
+    if (error) {
+      *error = "Decision forest shards do not hold every tree exactly once.";
+    }
+    return false;
+  }
+
+  DecisionForest merged_forest;
+
+  merged_forest.forest_params_ = forest_params;
+  merged_forest.forest_params_.shard_tree_start = 0;
+  merged_forest.forest_params_.shard_tree_count = 0;
+  merged_forest.tree_params_ = tree_params;
+
+  for (auto shard : sorted_shards) {
+    for (auto& tree : shard->decision_forest_) {
+      merged_forest.decision_forest_.push_back(::std::move(tree));
+    }
+
+    merged_forest.tree_training_times_.insert(
+        merged_forest.tree_training_times_.end(),
+        shard->tree_training_times_.begin(), shard->tree_training_times_.end());
+    shard->decision_forest_.clear();
+    shard->tree_training_times_.clear();
+  }
+
+  *output = ::std::move(merged_forest);
+
+  return true;
+}
+
 }  // namespace base
\ No newline at end of file
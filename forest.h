@@ -35,6 +35,8 @@
 #include <vector>
 
 #include "base_types.h"
+#include "compiled.h"
+#include "dataset.h"
 #include "tree.h"
 
 using ::std::vector;
@@ -46,26 +48,108 @@ typedef struct DecisionForestParams {
   uint32 total_tree_count;
   // what percent of training data is used for each tree.
   uint32 tree_training_percentage;
+  // how many threads to train with. set this value to zero
+  // to use all available hardware threads.
+  uint32 thread_count;
+  // master seed for training. tree i is seeded with random_seed + i, so
+  // a given seed reproduces a forest exactly, regardless of thread count.
+  // set this value to zero to select a seed (recorded here) at random.
+  uint32 random_seed;
+  // upper bound, in megabytes, on the memory used by trees that train
+  // concurrently. fewer trees are trained at once if the estimated memory
+  // for all threads exceeds this budget. set this value to zero for no
+  // limit.
+  uint32 memory_budget_mb;
+  // if non-zero, the forest is a shard that holds only shard_tree_count of
+  // the total_tree_count trees of a complete forest, starting with tree
+  // shard_tree_start. shards are trained by TrainShard and combined into
+  // a complete forest by MergeDecisionForests.
+  uint32 shard_tree_start;
+  uint32 shard_tree_count;
 } DecisionForestParams;
 
+typedef struct TreeTrainingTime {
+  // seconds from the start of forest training until the tree started.
+  float32 start_time;
+  // seconds from the start of forest training until the tree finished.
+  float32 finish_time;
+} TreeTrainingTime;
+
 class DecisionForest {
  public:
   bool Train(const DecisionForestParams& forest_params,
              const DecisionTreeParams& tree_params,
-             vector<ImageSet>* training_data, string* error = nullptr);
+             const Dataset* training_data, string* error = nullptr);
+  // Trains shard shard_index (counting from zero) of shard_count, which
+  // holds an even share of the trees that Train would produce. Each tree
+  // is identical to its counterpart in a complete forest trained with the
+  // same params and training data, so the random_seed must be specified
+  // and shared by every shard.
+  bool TrainShard(const DecisionForestParams& forest_params,
+                  const DecisionTreeParams& tree_params,
+                  const Dataset* training_data, uint32 shard_index,
+                  uint32 shard_count, string* error = nullptr);
+  // Trains tree_count additional trees, with the params of our existing
+  // trees, and adds them to the forest. As in Train, tree i of the grown
+  // forest is seeded with random_seed + i. The forest must be complete
+  // rather than a shard. Use AppendDecisionForest to add the new trees to
+  // the file that the forest was loaded from.
+  bool Grow(uint32 tree_count, const Dataset* training_data,
+            string* error = nullptr);
   // Classifies the input image and produces a label map.
   void ClassifyImage(Image* image_input, Image* label_output,
                      string* error = nullptr);
   // Classifies the input image and returns the dominant class index.
   uint8 Classify(Image* input, string* error = nullptr);
+  // Classifies an image within a dataset and returns the dominant class
+  // index. The dataset border must be at least our visual_search_radius
+  // (or half of each image dimension).
+  uint8 Classify(const Dataset& input, uint32 index, string* error = nullptr);
+  // Reorders our compiled trees (see CompiledForest::Reorder) according to
+  // the branches taken by every pixel of the first image_count images of
+  // calibration_data, or of all of its images if image_count is zero. The
+  // layout is kept until our trees change, and is preserved when our
+  // compiled trees are quantized.
+  bool OptimizeLayout(const Dataset& calibration_data, uint32 image_count,
+                      string* error = nullptr);
+  // Returns our compiled trees, compiling them if they have changed since
+  // they were last compiled, or nullptr if the forest cannot be compiled.
+  const CompiledForest* GetCompiledForest(string* error = nullptr);
   // Returns the params used to construct the forest.
   DecisionForestParams GetForestParams() const;
   // Returns the params used to construct each tree in the forest.
   DecisionTreeParams GetTreeParams() const;
+  // Returns when each tree started and finished during the last call to
+  // Train (or TrainShard or Grow), which is useful for measuring scheduling
+  // efficiency.
+  vector<TreeTrainingTime> GetTreeTrainingTimes() const;
 
  private:
+  // Validates our inputs and trains tree_count trees of a forest described
+  // by forest_params, starting with tree first_tree.
+  bool TrainTrees(const DecisionForestParams& forest_params,
+                  const DecisionTreeParams& tree_params,
+                  const Dataset* training_data, uint32 first_tree,
+                  uint32 tree_count, string* error);
+  // Compiles our trees, if they have changed since they were last
+  // compiled, and binds them to the layout of input.
+  bool PrepareCompiledForest(const Dataset& input, string* error);
+  // Classifies pixels [first_pixel, first_pixel + pixel_count) of image
+  // index of input, in row major order, as a single batch. pixel_count may
+  // not exceed kCompiledBatchSize.
+  void ClassifyPixelBatch(const Dataset& input, uint32 index,
+                          uint32 first_pixel, uint32 pixel_count,
+                          uint8* pixel_classes);
+
   // Our internal forest of decision trees.
   vector<DecisionTree> decision_forest_;
+  // Per tree timings recorded by Train.
+  vector<TreeTrainingTime> tree_training_times_;
+  // A flattened copy of our trees, which classifies on their behalf. It is
+  // cleared whenever our trees change and compiled on demand.
+  CompiledForest compiled_forest_;
+  // Scratch space for batched classification.
+  CompiledBatch classify_batch_;
   // Overall forest parameters.
   DecisionForestParams forest_params_;
   // Tree level parameters.
@@ -76,8 +160,19 @@ class DecisionForest {
                                  string* error);
   friend bool LoadDecisionForest(const string& filename, DecisionForest* output,
                                  string* error);
+  friend bool AppendDecisionForest(const string& filename,
+                                   DecisionForest* input, string* error);
+  friend bool MergeDecisionForests(vector<DecisionForest>* shards,
+                                   DecisionForest* output, string* error);
 };
 
+// Combines shards (see DecisionForest::TrainShard) into a complete forest.
+// The shards may be supplied in any order, but must share their params and
+// together hold every tree of the forest exactly once. Trees are moved out
+// of the shards.
+bool MergeDecisionForests(vector<DecisionForest>* shards,
+                          DecisionForest* output, string* error = nullptr);
+
 }  // namespace base
 
 #endif  // __DECISION_FOREST_H__
\ No newline at end of file
@@ -1,100 +1,160 @@
 
 #include "histogram.h"
 
+#if defined(__SSE2__) || defined(_M_X64) || \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define ENABLE_SSE2 (1)
+#include <emmintrin.h>
+#endif
+
 namespace base {
 
-Histogram::Histogram() { sample_total_ = 0; }
+float64 g_entropy_table[kEntropyTableSize];
 
-Histogram::Histogram(uint32 class_count) { Initialize(class_count); }
+// Populates g_entropy_table during static initialization.
+struct EntropyTableInitializer {
+  EntropyTableInitializer() {
+    g_entropy_table[0] = 0.0;
 
-void Histogram::Initialize(uint32 class_count) {
-  sample_total_ = 0;
-  class_totals_.resize(class_count);
-  memset(&class_totals_.at(0), 0, sizeof(uint32) * class_count);
-}
+    for (uint32 i = 1; i < kEntropyTableSize; i++) {
+      g_entropy_table[i] = i * log2(static_cast<float64>(i));
+    }
+  }
+} g_entropy_table_initializer;
 
-bool Histogram::IncrementValue(uint32 class_index) {
-  if (class_totals_.size() <= class_index) {
-    return false;
+#if ENABLE_SSE2
+// Returns the lane-wise maximum of two vectors of totals below 2^31.
+inline __m128i MaxTotals(__m128i a, __m128i b) {
+  __m128i mask = _mm_cmpgt_epi32(a, b);
+  return _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b));
+}
+#endif
+
+void AddClassTotals(const uint32* source, uint32 lane_count, uint32* target) {
+#if ENABLE_SSE2
+  for (uint32 i = 0; i < lane_count; i += kHistogramLaneCount) {
+    __m128i* output = (__m128i*)(target + i);
+    __m128i input = _mm_loadu_si128((const __m128i*)(source + i));
+    _mm_storeu_si128(output, _mm_add_epi32(_mm_loadu_si128(output), input));
+  }
+#else
+  for (uint32 i = 0; i < lane_count; i++) {
+    target[i] += source[i];
   }
+#endif
+}
 
-  sample_total_++;
-  class_totals_.at(class_index)++;
-  return true;
+void SubtractClassTotals(const uint32* source, uint32 lane_count,
+                         uint32* target) {
+#if ENABLE_SSE2
+  for (uint32 i = 0; i < lane_count; i += kHistogramLaneCount) {
+    __m128i* output = (__m128i*)(target + i);
+    __m128i input = _mm_loadu_si128((const __m128i*)(source + i));
+    _mm_storeu_si128(output, _mm_sub_epi32(_mm_loadu_si128(output), input));
+  }
+#else
+  for (uint32 i = 0; i < lane_count; i++) {
+    target[i] -= source[i];
+  }
+#endif
 }
 
-uint64 Histogram::GetSampleTotal() const { return sample_total_; }
+uint32 FindDominantClass(const uint32* totals, uint32 lane_count) {
+#if ENABLE_SSE2
+  // Find the highest total, broadcast across all lanes, and then return the
+  // first lane that holds it.
+  __m128i highest = _mm_setzero_si128();
 
-void Histogram::ClearClass(uint32 class_index) {
-  if (class_totals_.size() <= class_index) {
-    return;
+  for (uint32 i = 0; i < lane_count; i += kHistogramLaneCount) {
+    highest =
+        MaxTotals(highest, _mm_loadu_si128((const __m128i*)(totals + i)));
   }
 
-  sample_total_ -= class_totals_.at(class_index);
-  class_totals_.at(class_index) = 0;
-}
+  highest = MaxTotals(highest,
+                      _mm_shuffle_epi32(highest, _MM_SHUFFLE(1, 0, 3, 2)));
+  highest = MaxTotals(highest,
+                      _mm_shuffle_epi32(highest, _MM_SHUFFLE(2, 3, 0, 1)));
 
-float32 Histogram::GetPercentage(uint32 class_index) const {
-  if (class_totals_.size() <= class_index) {
-    return 0.0f;
-  }
+  for (uint32 i = 0; i < lane_count; i += kHistogramLaneCount) {
+    __m128i match = _mm_cmpeq_epi32(
+        _mm_loadu_si128((const __m128i*)(totals + i)), highest);
+    int32 match_mask = _mm_movemask_ps(_mm_castsi128_ps(match));
 
-  if (0 == sample_total_) {
-    return 0.0f;
+    for (uint32 j = 0; match_mask; j++, match_mask >>= 1) {
+      if (match_mask & 0x1) {
+        return i + j;
+      }
+    }
   }
 
-  return static_cast<float32>(class_totals_.at(class_index)) / sample_total_;
-}
-
-uint32 Histogram::GetDominantClass() const {
+  return 0;
+#else
   uint32 highest_total = 0;
   uint32 highest_index = 0;
 
-  // This will return the first class if there is no conclusive winner.
-  // We're OK with this since it's probably as good a guess as any.
-  for (uint32 index = 0; index < class_totals_.size(); index++) {
-    if (class_totals_.at(index) > highest_total) {
-      highest_total = class_totals_.at(index);
+  for (uint32 index = 0; index < lane_count; index++) {
+    if (totals[index] > highest_total) {
+      highest_total = totals[index];
       highest_index = index;
     }
   }
   return highest_index;
+#endif
 }
 
-float32 Histogram::GetEntropy() const {
-  float32 total = 0.0f;
-
-  for (uint32 i = 0; i < class_totals_.size(); i++) {
-    float32 class_probability = GetPercentage(i);
-
-    if (class_probability > 0) {
-      total = total + class_probability * log2(class_probability);
-    }
+void AddClassPosteriors(const float32* source, uint32 lane_count,
+                        float32* target) {
+#if ENABLE_SSE2
+  for (uint32 i = 0; i < lane_count; i += kHistogramLaneCount) {
+    __m128 input = _mm_loadu_ps(source + i);
+    _mm_storeu_ps(target + i, _mm_add_ps(_mm_loadu_ps(target + i), input));
   }
-
-  return -1.0f * total;
+#else
+  for (uint32 i = 0; i < lane_count; i++) {
+    target[i] += source[i];
+  }
+#endif
 }
 
-uint32 Histogram::GetClassCount() const { return class_totals_.size(); }
+uint32 FindDominantPosterior(const float32* posteriors, uint32 lane_count) {
+#if ENABLE_SSE2
+  // As with FindDominantClass, we broadcast the highest posterior and then
+  // return the first lane that holds it.
+  __m128 highest = _mm_setzero_ps();
 
-uint32 Histogram::GetClassTotal(uint32 class_index) const {
-  if (class_totals_.size() <= class_index) {
-    return 0;
+  for (uint32 i = 0; i < lane_count; i += kHistogramLaneCount) {
+    highest = _mm_max_ps(highest, _mm_loadu_ps(posteriors + i));
   }
 
-  return class_totals_.at(class_index);
-}
+  highest = _mm_max_ps(
+      highest, _mm_shuffle_ps(highest, highest, _MM_SHUFFLE(1, 0, 3, 2)));
+  highest = _mm_max_ps(
+      highest, _mm_shuffle_ps(highest, highest, _MM_SHUFFLE(2, 3, 0, 1)));
+
+  for (uint32 i = 0; i < lane_count; i += kHistogramLaneCount) {
+    int32 match_mask =
+        _mm_movemask_ps(_mm_cmpeq_ps(_mm_loadu_ps(posteriors + i), highest));
 
-Histogram& Histogram::operator+=(const Histogram& rhs) {
-  if (class_totals_.size() != rhs.class_totals_.size()) {
-    return (*this);
+    for (uint32 j = 0; match_mask; j++, match_mask >>= 1) {
+      if (match_mask & 0x1) {
+        return i + j;
+      }
+    }
   }
 
-  sample_total_ += rhs.sample_total_;
-  for (uint32 i = 0; i < class_totals_.size(); i++) {
-    class_totals_.at(i) += rhs.class_totals_.at(i);
+  return 0;
+#else
+  float32 highest_posterior = 0.0f;
+  uint32 highest_index = 0;
+
+  for (uint32 index = 0; index < lane_count; index++) {
+    if (posteriors[index] > highest_posterior) {
+      highest_posterior = posteriors[index];
+      highest_index = index;
+    }
   }
-  return (*this);
+  return highest_index;
+#endif
 }
 
 }  // namespace base
@@ -32,55 +32,274 @@
 #ifndef __HISTOGRAM_H__
 #define __HISTOGRAM_H__
 
-#include <fstream>
+#include <cmath>
+#include <cstring>
 #include <vector>
 #include "base_types.h"
 
-using ::std::ifstream;
-using ::std::ofstream;
 using ::std::vector;
 
 namespace base {
 
-class Histogram {
+// Class totals are processed kHistogramLaneCount at a time. Storage is
+// padded to a multiple of this, and padding lanes always hold zero.
+const uint32 kHistogramLaneCount = 4;
+
+// Labels are 8 bit values, which limits us to 256 classes.
+const uint32 kMaxClassCount = 256;
+
+// The number of classes that a Histogram stores inline. This covers our
+// MNIST labels (ten digits plus background); histograms with more classes
+// (up to the 256 label limit) store their totals on the heap.
+const uint32 kHistogramInlineClassCount = 16;
+
+// The number of counts for which n * log2(n) is precomputed.
+const uint32 kEntropyTableSize = 4096;
+
+// Precomputed n * log2(n) for n < kEntropyTableSize (with 0 * log2(0) = 0).
+extern float64 g_entropy_table[kEntropyTableSize];
+
+// Returns n * log2(n). The entropy of a set of N samples with class counts
+// n_i is (f(N) - sum(f(n_i))) / N, which lets us compute entropy from
+// integer counts without a divide or a log per class.
+inline float64 GetEntropyTerm(uint64 count) {
+  if (count < kEntropyTableSize) {
+    return g_entropy_table[count];
+  }
+
+  float64 value = static_cast<float64>(count);
+  return value * log2(value);
+}
+
+// Adds lane_count totals from source to target.
+void AddClassTotals(const uint32* source, uint32 lane_count, uint32* target);
+// Subtracts lane_count totals in source from target.
+void SubtractClassTotals(const uint32* source, uint32 lane_count,
+                         uint32* target);
+// Returns the index of the first of lane_count totals with the highest
+// value. Totals must be less than 2^31.
+uint32 FindDominantClass(const uint32* totals, uint32 lane_count);
+// Adds lane_count class posteriors (probabilities) from source to target.
+void AddClassPosteriors(const float32* source, uint32 lane_count,
+                        float32* target);
+// Returns the index of the first of lane_count non-negative posteriors with
+// the highest value.
+uint32 FindDominantPosterior(const float32* posteriors, uint32 lane_count);
+
+// A histogram of class totals. Histograms with up to kInlineClassCount
+// classes store their totals inline, so they may be constructed, copied
+// and combined without heap allocations.
+template <uint32 kInlineClassCount>
+class BasicHistogram {
  public:
-  Histogram();
+  BasicHistogram();
   // Initializes with a specific class count.
-  Histogram(uint32 class_count);
+  BasicHistogram(uint32 class_count);
   // Initializes with a specific class count.
   void Initialize(uint32 class_count);
+  // Zeroes every class total, retaining the class count.
+  void Clear();
   // Increments a specific class total. Does not recompute entropy.
   bool IncrementValue(uint32 class_index);
+  // Increments a specific class total by count.
+  bool IncrementValue(uint32 class_index, uint32 count);
   // Queries the percentage coverage of a specific class.
   float32 GetPercentage(uint32 class_index) const;
   // Computes entropy for the current sample set.
   float32 GetEntropy() const;
+  // Computes Gini impurity (1 - sum(p^2)) for the current sample set.
+  float32 GetGiniImpurity() const;
   // Removes a class from the histogram. This is used to ignore
   // certain features (e.g. background classes).
   void ClearClass(uint32 class_index);
   // Queries the total number of samples contained in the histogram.
-  uint64 GetSampleTotal() const;
+  uint64 GetSampleTotal() const { return sample_total_; }
   // Queries the number of classes covered by the histogram.
-  uint32 GetClassCount() const;
+  uint32 GetClassCount() const { return class_count_; }
   // Queries the population of a specific class.
   uint32 GetClassTotal(uint32 class_index) const;
   // Returns the class index with the highest representation.
   uint32 GetDominantClass() const;
   // Support the ability to combine histograms.
-  Histogram& operator+=(const Histogram& rhs);
+  BasicHistogram& operator+=(const BasicHistogram& rhs);
+  // Removes the samples of rhs, which must be a subset of this histogram.
+  BasicHistogram& operator-=(const BasicHistogram& rhs);
 
  private:
-  // The total number of samples tracked in class_totals_.
+  uint32* GetTotals() {
+    return class_count_ <= kInlineClassCount ? inline_totals_
+                                             : heap_totals_.data();
+  }
+  const uint32* GetTotals() const {
+    return class_count_ <= kInlineClassCount ? inline_totals_
+                                             : heap_totals_.data();
+  }
+  // The number of padded lanes in our storage.
+  uint32 GetLaneCount() const {
+    return (class_count_ + kHistogramLaneCount - 1) & ~(kHistogramLaneCount - 1);
+  }
+
+  // The total number of samples tracked in our class totals.
   uint64 sample_total_;
-  // The per-class totals.
-  vector<uint32> class_totals_;
-  // Provide access for our serialization API.
-  friend bool SaveHistogram(ofstream* out_stream, const Histogram& input,
-                            string* error);
-  friend bool LoadHistogram(ifstream* in_stream, Histogram* output,
-                            string* error);
+  uint32 class_count_;
+  // The per-class totals, stored inline or on the heap (see GetTotals).
+  uint32 inline_totals_[kInlineClassCount];
+  vector<uint32> heap_totals_;
 };
 
+typedef BasicHistogram<kHistogramInlineClassCount> Histogram;
+
+template <uint32 kInlineClassCount>
+BasicHistogram<kInlineClassCount>::BasicHistogram() {
+  Initialize(0);
+}
+
+template <uint32 kInlineClassCount>
+BasicHistogram<kInlineClassCount>::BasicHistogram(uint32 class_count) {
+  Initialize(class_count);
+}
+
+template <uint32 kInlineClassCount>
+void BasicHistogram<kInlineClassCount>::Initialize(uint32 class_count) {
+  class_count_ = class_count;
+
+  if (class_count_ > kInlineClassCount) {
+    heap_totals_.resize(GetLaneCount());
+  }
+
+  Clear();
+}
+
+template <uint32 kInlineClassCount>
+void BasicHistogram<kInlineClassCount>::Clear() {
+  sample_total_ = 0;
+
+  if (class_count_ <= kInlineClassCount) {
+    memset(inline_totals_, 0, sizeof(inline_totals_));
+  } else {
+    memset(heap_totals_.data(), 0, sizeof(uint32) * heap_totals_.size());
+  }
+}
+
+template <uint32 kInlineClassCount>
+bool BasicHistogram<kInlineClassCount>::IncrementValue(uint32 class_index) {
+  return IncrementValue(class_index, 1);
+}
+
+template <uint32 kInlineClassCount>
+bool BasicHistogram<kInlineClassCount>::IncrementValue(uint32 class_index,
+                                                       uint32 count) {
+  if (class_count_ <= class_index) {
+    return false;
+  }
+
+  sample_total_ += count;
+  GetTotals()[class_index] += count;
+  return true;
+}
+
+template <uint32 kInlineClassCount>
+void BasicHistogram<kInlineClassCount>::ClearClass(uint32 class_index) {
+  if (class_count_ <= class_index) {
+    return;
+  }
+
+  sample_total_ -= GetTotals()[class_index];
+  GetTotals()[class_index] = 0;
+}
+
+template <uint32 kInlineClassCount>
+float32 BasicHistogram<kInlineClassCount>::GetPercentage(
+    uint32 class_index) const {
+  if (class_count_ <= class_index) {
+    return 0.0f;
+  }
+
+  if (0 == sample_total_) {
+    return 0.0f;
+  }
+
+  return static_cast<float32>(GetTotals()[class_index]) / sample_total_;
+}
+
+template <uint32 kInlineClassCount>
+uint32 BasicHistogram<kInlineClassCount>::GetDominantClass() const {
+  // This will return the first class if there is no conclusive winner.
+  // We're OK with this since it's probably as good a guess as any.
+  if (!class_count_) {
+    return 0;
+  }
+
+  return FindDominantClass(GetTotals(), GetLaneCount());
+}
+
+template <uint32 kInlineClassCount>
+float32 BasicHistogram<kInlineClassCount>::GetEntropy() const {
+  if (!sample_total_) {
+    return 0.0f;
+  }
+
+  const uint32* totals = GetTotals();
+  float64 impurity = GetEntropyTerm(sample_total_);
+
+  for (uint32 i = 0; i < class_count_; i++) {
+    impurity -= GetEntropyTerm(totals[i]);
+  }
+
+  return static_cast<float32>(impurity / sample_total_);
+}
+
+template <uint32 kInlineClassCount>
+float32 BasicHistogram<kInlineClassCount>::GetGiniImpurity() const {
+  if (!sample_total_) {
+    return 0.0f;
+  }
+
+  const uint32* totals = GetTotals();
+  float64 sum_squares = 0.0;
+
+  for (uint32 i = 0; i < class_count_; i++) {
+    sum_squares += static_cast<float64>(totals[i]) * totals[i];
+  }
+
+  return static_cast<float32>((sample_total_ - sum_squares / sample_total_) /
+                              sample_total_);
+}
+
+template <uint32 kInlineClassCount>
+uint32 BasicHistogram<kInlineClassCount>::GetClassTotal(
+    uint32 class_index) const {
+  if (class_count_ <= class_index) {
+    return 0;
+  }
+
+  return GetTotals()[class_index];
+}
+
+template <uint32 kInlineClassCount>
+BasicHistogram<kInlineClassCount>& BasicHistogram<kInlineClassCount>::
+operator+=(const BasicHistogram& rhs) {
+  if (class_count_ != rhs.class_count_) {
+    return (*this);
+  }
+
+  sample_total_ += rhs.sample_total_;
+  AddClassTotals(rhs.GetTotals(), GetLaneCount(), GetTotals());
+  return (*this);
+}
+
+template <uint32 kInlineClassCount>
+BasicHistogram<kInlineClassCount>& BasicHistogram<kInlineClassCount>::
+operator-=(const BasicHistogram& rhs) {
+  if (class_count_ != rhs.class_count_) {
+    return (*this);
+  }
+
+  sample_total_ -= rhs.sample_total_;
+  SubtractClassTotals(rhs.GetTotals(), GetLaneCount(), GetTotals());
+  return (*this);
+}
+
 }  // namespace base
 
 #endif  // __HISTOGRAM_H__
\ No newline at end of file
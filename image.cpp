@@ -5,6 +5,8 @@
 #include <set>
 #include <utility>
 
+#include "dataset.h"
+
 using ::std::ifstream;
 using ::std::set;
 
@@ -32,24 +34,18 @@ void Image::SetPixel(uint32 x, uint32 y, uint8 value) {
   data.at(y * width + x) = value;
 }
 
-bool LoadImageSet(const string& images_filename, const string& labels_filename,
-                  vector<ImageSet>* output, uint32* label_count,
-                  string* error) {
-  if (images_filename.empty() || labels_filename.empty() || !output ||
-      !label_count) {
-    if (error) {
-      *error = "Invalid inputs to LoadImageSet.";
-    }
-    return false;
-  }
-
-  MNIST_IMAGE_FILE_HEADER image_header;
+// Opens an MNIST image and label file pair and reads their headers, leaving
+// each stream positioned at its first image or label.
+bool OpenImageSet(const string& images_filename,
+                  const string& labels_filename, ifstream* image_source,
+                  ifstream* label_source,
+                  MNIST_IMAGE_FILE_HEADER* image_header, string* error) {
   MNIST_LABEL_FILE_HEADER label_header;
 
-  ifstream image_source(images_filename, ::std::ios::in | ::std::ios::binary);
-  ifstream label_source(labels_filename, ::std::ios::in | ::std::ios::binary);
+  image_source->open(images_filename, ::std::ios::in | ::std::ios::binary);
+  label_source->open(labels_filename, ::std::ios::in | ::std::ios::binary);
 
-  if (!image_source || !label_source) {
+  if (!*image_source || !*label_source) {
     if (error) {
       *error = "Failed to open data files.";
     }
@@ -57,10 +53,10 @@ bool LoadImageSet(const string& images_filename, const string& labels_filename,
   }
 
   // Read in both headers. Data counts must match.
-  if (!image_source.read((char*)&image_header,
-                         sizeof(MNIST_IMAGE_FILE_HEADER)) ||
-      !label_source.read((char*)&label_header,
-                         sizeof(MNIST_LABEL_FILE_HEADER))) {
+  if (!image_source->read((char*)image_header,
+                          sizeof(MNIST_IMAGE_FILE_HEADER)) ||
+      !label_source->read((char*)&label_header,
+                          sizeof(MNIST_LABEL_FILE_HEADER))) {
     if (error) {
       *error = "Failed to read MNIST image and/or label file headers.";
     }
@@ -68,35 +64,58 @@ bool LoadImageSet(const string& images_filename, const string& labels_filename,
   }
 
   // Parse the image header, swapping the dwords into little endian.
-  image_header.magic = EndianSwap8in32(image_header.magic);
-  image_header.image_count = EndianSwap8in32(image_header.image_count);
-  image_header.width = EndianSwap8in32(image_header.width);
-  image_header.height = EndianSwap8in32(image_header.height);
+  image_header->magic = EndianSwap8in32(image_header->magic);
+  image_header->image_count = EndianSwap8in32(image_header->image_count);
+  image_header->width = EndianSwap8in32(image_header->width);
+  image_header->height = EndianSwap8in32(image_header->height);
 
   // Parse the label header, swapping the dwords into little endian.
   label_header.magic = EndianSwap8in32(label_header.magic);
   label_header.label_count = EndianSwap8in32(label_header.label_count);
 
-  if (image_header.magic != 2051 || label_header.magic != 2049) {
+  if (image_header->magic != 2051 || label_header.magic != 2049) {
     if (error) {
       *error = "Invalid MNIST data file(s) detected.";
     }
     return false;
   }
 
-  if (image_header.image_count != label_header.label_count) {
+  if (image_header->image_count != label_header.label_count) {
     if (error) {
       *error = "Image and label count mismatch.";
     }
     return false;
   }
 
+  return true;
+}
+
+bool LoadImageSet(const string& images_filename, const string& labels_filename,
+                  uint32 border, Dataset* output, uint32* label_count,
+                  string* error) {
+  if (images_filename.empty() || labels_filename.empty() || !output ||
+      !label_count) {
+    if (error) {
+      *error = "Invalid inputs to LoadImageSet.";
+    }
+    return false;
+  }
+
+  MNIST_IMAGE_FILE_HEADER image_header;
+  ifstream image_source;
+  ifstream label_source;
+
+  if (!OpenImageSet(images_filename, labels_filename, &image_source,
+                    &label_source, &image_header, error)) {
+    return false;
+  }
+
   // File reads have a relatively high fixed cost, so we load the entire
   //   data set into memory and then scatter afterwards.
   vector<uint8> image_file_buffer(image_header.image_count *
                                   image_header.width * image_header.height);
 
-  vector<uint8> label_file_buffer(label_header.label_count);
+  vector<uint8> label_file_buffer(image_header.image_count);
 
   // Read in both sets of data.
   if (!image_source.read((char*)&image_file_buffer.at(0),
@@ -109,7 +128,7 @@ bool LoadImageSet(const string& images_filename, const string& labels_filename,
   }
 
   if (!label_source.read((char*)&label_file_buffer.at(0),
-                         label_header.label_count)) {
+                         image_header.image_count)) {
     if (error) {
       *error = "Failed to read label data from disk.";
     }
@@ -117,45 +136,40 @@ bool LoadImageSet(const string& images_filename, const string& labels_filename,
   }
 
   set<uint32> label_set;
-  output->resize(image_header.image_count);
+  uint32 image_size = image_header.width * image_header.height;
+  vector<uint8> labels(image_size);
+
+  // Allocate space for our image and label data. Labels are defined on
+  // a per-pixel basis in order to support images with multiple
+  // objects (even though our MNIST data set doesn't support this.
+  if (!output->Initialize(image_header.image_count, image_header.width,
+                          image_header.height, border, error)) {
+    return false;
+  }
 
   for (uint32 i = 0; i < image_header.image_count; i++) {
-    ImageSet* training_set = &output->at(i);
-
-    // Allocate space for our image data.
-    training_set->image.Initialize(image_header.width, image_header.height);
+    const uint8* data = &image_file_buffer.at(image_size * i);
 
-    // Allocate space for our label data. Labels are defined on
-    // a per-pixel basis in order to support images with multiple
-    // objects (even though our MNIST data set doesn't support this.
-    training_set->label.Initialize(image_header.width, image_header.height);
-
-    // Populate our image data.
-    memcpy(&training_set->image.data.at(0),
-           &image_file_buffer.at(image_header.width * image_header.height * i),
-           image_header.width * image_header.height);
+    // Populate our image data, along with its mirrored border.
+    output->SetImage(i, data);
 
     // Set our codex equal to the label for the entire file.
-    training_set->codex = label_file_buffer.at(i);
+    output->SetCodex(i, label_file_buffer.at(i));
 
     // Populate our label data. We reserve a value of 0xFF to indicate
     // background, and will incorporate this label into training.
-    for (uint32 y = 0; y < image_header.height; y++) {
-      for (uint32 x = 0; x < image_header.width; x++) {
-        Image* data = &training_set->image;
-        Image* labels = &training_set->label;
-        uint8 image_value = data->GetPixel(x, y);
-
-        if (image_value) {
-          labels->SetPixel(x, y, label_file_buffer.at(i));
-        } else {
-          labels->SetPixel(x, y, kBackgroundClassLabel);
-        }
-
-        // Catalog the set of labels in our training set.
-        label_set.insert(labels->GetPixel(x, y));
+    for (uint32 j = 0; j < image_size; j++) {
+      if (data[j]) {
+        labels[j] = label_file_buffer.at(i);
+      } else {
+        labels[j] = kBackgroundClassLabel;
       }
+
+      // Catalog the set of labels in our training set.
+      label_set.insert(labels[j]);
     }
+
+    output->SetLabels(i, labels.data());
   }
 
   *label_count = label_set.size();
@@ -163,4 +177,62 @@ bool LoadImageSet(const string& images_filename, const string& labels_filename,
   return true;
 }
 
+bool ConvertImageSet(const string& images_filename,
+                     const string& labels_filename, uint32 border,
+                     const string& output_filename, uint32* label_count,
+                     string* error) {
+  if (images_filename.empty() || labels_filename.empty() ||
+      output_filename.empty() || !label_count) {
+    if (error) {
+      *error = "Invalid inputs to ConvertImageSet.";
+    }
+    return false;
+  }
+
+  MNIST_IMAGE_FILE_HEADER image_header;
+  ifstream image_source;
+  ifstream label_source;
+  DatasetWriter writer;
+
+  if (!OpenImageSet(images_filename, labels_filename, &image_source,
+                    &label_source, &image_header, error) ||
+      !writer.Open(output_filename, image_header.image_count,
+                   image_header.width, image_header.height, border, error)) {
+    return false;
+  }
+
+  set<uint32> label_set;
+  uint32 image_size = image_header.width * image_header.height;
+  vector<uint8> image_buffer(image_size);
+  vector<uint8> label_buffer(image_size);
+
+  // Images are read, labelled (as in LoadImageSet) and written one at a
+  // time, so the set never needs to fit in memory.
+  for (uint32 i = 0; i < image_header.image_count; i++) {
+    uint8 label = 0;
+
+    if (!image_source.read((char*)image_buffer.data(), image_size) ||
+        !label_source.read((char*)&label, sizeof(uint8))) {
+      if (error) {
+        *error = "Failed to read image data from disk.";
+      }
+      return false;
+    }
+
+    for (uint32 j = 0; j < image_size; j++) {
+      label_buffer[j] = image_buffer[j] ? label : kBackgroundClassLabel;
+      label_set.insert(label_buffer[j]);
+    }
+
+    if (!writer.WriteImage(image_buffer.data(), label_buffer.data(), label,
+                           error)) {
+      return false;
+    }
+  }
+
+  *label_count = label_set.size();
+
+  return writer.Close(*label_count, error);
+}
+
 }  // namespace base
\ No newline at end of file
@@ -91,9 +91,20 @@ inline uint32 EndianSwap8in32(uint32 input) {
          (input << 24);
 }
 
+class Dataset;
+
+// Loads an MNIST image and label file pair into a dataset, whose images
+// carry a mirrored border of the specified width (see Dataset).
 bool LoadImageSet(const string& images_filename, const string& labels_filename,
-                  vector<ImageSet>* output, uint32* label_count,
+                  uint32 border, Dataset* output, uint32* label_count,
                   string* error = nullptr);
+// Converts an MNIST image and label file pair into a dataset file that
+// Dataset::Map can map, one image at a time. Images carry a mirrored
+// border of the specified width.
+bool ConvertImageSet(const string& images_filename,
+                     const string& labels_filename, uint32 border,
+                     const string& output_filename, uint32* label_count,
+                     string* error = nullptr);
 
 }  // namespace base
 
@@ -1,4 +1,7 @@
 
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
 #include <iostream>
 #include <memory>
 #include <string>
@@ -7,6 +10,7 @@
 #include "bitmap.h"
 #include "forest.h"
 #include "image.h"
+#include "quantized.h"
 #include "storage.h"
 #include "time.h"
 #include "tree.h"
@@ -50,12 +54,63 @@ void PrintUsage(const char* programName) {
   cout << "  --verify [input forest filename] \t\t\tTests the accuracy of a "
           "forest against the "
        << "MNIST test set." << endl;
+  cout << "  --benchmark [tree count]\t\t\t\tCompares training time and "
+          "accuracy of "
+       << "each split criterion." << endl;
+  cout << "  --dataset [output dataset filename]\t\t\tConverts the MNIST "
+          "training set "
+       << "into a dataset file." << endl;
+  cout << "  --stream [dataset filename] [output forest filename]\t"
+       << "Generates a forest from a memory mapped dataset file." << endl;
+  cout << "  --train-shard [shard/shard count] [random seed] [output forest "
+          "filename]\t"
+       << "Generates one shard of a forest." << endl;
+  cout << "  --merge [output forest filename] [shard filenames...]\t"
+       << "Combines forest shards into a complete forest." << endl;
+  cout << "  --grow [forest filename] [tree count]\t\t\tAdds trees to a "
+          "forest file and "
+       << "tests its accuracy." << endl;
+  cout << "  --quantize [input forest filename] [output forest filename] "
+          "[calibration image count]\t"
+       << "Converts a forest to the quantized format and reports the change "
+          "in accuracy."
+       << endl;
+}
+
+const char* GetSplitCriterionName(uint32 split_criterion) {
+  return kSplitCriterionGini == split_criterion ? "gini" : "entropy";
 }
 
 void PrintForestParams(const DecisionForestParams& params) {
   cout << "  Tree count: " << params.total_tree_count << endl;
   cout << "  Tree train percentage: " << params.tree_training_percentage
        << endl;
+  cout << "  Training thread count: " << params.thread_count << endl;
+  cout << "  Random seed: " << params.random_seed << endl;
+  cout << "  Memory budget (MB): " << params.memory_budget_mb << endl;
+
+  if (params.shard_tree_count) {
+    cout << "  Shard trees: " << params.shard_tree_start << " to "
+         << params.shard_tree_start + params.shard_tree_count - 1 << endl;
+  }
+}
+
+void PrintTreeTrainingTimes(const vector<TreeTrainingTime>& times,
+                            float32 elapsed_seconds) {
+  float32 busy_seconds = 0.0f;
+
+  for (uint32 i = 0; i < times.size(); i++) {
+    float32 duration = times[i].finish_time - times[i].start_time;
+    busy_seconds += duration;
+    cout << "  Tree " << i << ": started at " << times[i].start_time
+         << "s, finished at " << times[i].finish_time << "s (" << duration
+         << "s)." << endl;
+  }
+
+  if (elapsed_seconds > 0.0f) {
+    cout << "  Average concurrent trees: " << busy_seconds / elapsed_seconds
+         << endl;
+  }
 }
 
 void PrintTreeParams(const DecisionTreeParams& params) {
@@ -64,12 +119,64 @@ void PrintTreeParams(const DecisionTreeParams& params) {
   cout << "  Min node sample count: " << params.min_sample_count << endl;
   cout << "  Max node trial count: " << params.node_trial_count << endl;
   cout << "  Max visual search radius: " << params.visual_search_radius << endl;
+  cout << "  Tree growth mode: "
+       << (kTreeGrowthLevelWise == params.tree_growth_mode ? "level wise"
+                                                            : "depth first")
+       << endl;
+  cout << "  Split criterion: " << GetSplitCriterionName(params.split_criterion)
+       << endl;
+  cout << "  Trial race sample count: " << params.trial_race_sample_count
+       << endl;
+  cout << "  Max split search samples: " << params.max_split_search_samples
+       << endl;
+  cout << "  Learned split thresholds: "
+       << (params.learn_split_thresholds ? "yes" : "no") << endl;
+  cout << "  Feature bank size: " << params.feature_bank_size << endl;
+}
+
+// Classifies every image in data and reports the percentage of images
+// whose dominant class matches their codex.
+template <typename Forest>
+bool MeasureAccuracy(Forest* forest, const Dataset& data, float32* accuracy,
+                     string* error) {
+  float32 total_correct = 0.0f;
+
+  for (uint32 i = 0; i < data.GetImageCount(); i++) {
+    uint8 forest_result = forest->Classify(data, i, error);
+    uint8 ground_truth = data.GetCodex(i);
+
+    if (error && error->length()) {
+      return false;
+    }
+
+    total_correct += (forest_result == ground_truth);
+  }
+
+  *accuracy = 100.0f * total_correct / data.GetImageCount();
+  return true;
 }
 
-void ExecuteTraining(const string& output_filename) {
+// Trains on the MNIST training set or, if dataset_filename is specified,
+// on a dataset file that is mapped (rather than loaded) into memory. If
+// shard_count is non-zero, only shard shard_index of the forest is trained.
+void ExecuteTraining(const string& output_filename,
+                     const string& dataset_filename, uint32 shard_index = 0,
+                     uint32 shard_count = 0, uint32 random_seed = 0) {
   string error;
   uint32 label_count = 0;
-  vector<ImageSet> training_data;
+  Dataset training_data;
+  DecisionForest forest;
+  DecisionForestParams forest_params = {};
+  DecisionTreeParams tree_params = {};
+
+  forest_params.total_tree_count = 18;
+  forest_params.tree_training_percentage = 80;
+  tree_params.max_tree_depth = 20;
+  tree_params.node_trial_count = 1200;
+  tree_params.visual_search_radius = 20;
+  tree_params.min_sample_count = 2;
+
+  forest_params.random_seed = random_seed;
 
   if (output_filename.empty()) {
     cout << "You must specify a valid forest filename to save the forest."
@@ -79,23 +186,36 @@ void ExecuteTraining(const string& output_filename) {
 
   cout << "Loading training data..." << endl;
 
-  if (!LoadImageSet(mnist_training_images, mnist_training_labels,
-                    &training_data, &label_count, &error)) {
+  // Training images carry a mirrored border wide enough for our split
+  // functions to probe directly.
+  if (!dataset_filename.empty()) {
+    if (!training_data.Map(dataset_filename, &label_count, &error)) {
+      cout << "Error detected during data load: " << error << endl;
+      return;
+    }
+  } else if (!LoadImageSet(mnist_training_images, mnist_training_labels,
+                           tree_params.visual_search_radius, &training_data,
+                           &label_count, &error)) {
     cout << "Error detected during data load: " << error << endl;
     return;
   }
 
-  cout << "Loaded " << training_data.size() << " training samples." << endl;
+  cout << "Loaded " << training_data.GetImageCount() << " training samples."
+       << endl;
 
-  DecisionForest forest;
-  DecisionForestParams forest_params = {18, 80};
-  DecisionTreeParams tree_params = {20, 1200, label_count, 20, 2};
+  tree_params.class_count = label_count;
 
   uint64 start_time = GetSystemTime();
 
   cout << "Initiating training sequence." << endl;
 
-  if (!forest.Train(forest_params, tree_params, &training_data, &error)) {
+  bool trained =
+      shard_count
+          ? forest.TrainShard(forest_params, tree_params, &training_data,
+                              shard_index, shard_count, &error)
+          : forest.Train(forest_params, tree_params, &training_data, &error);
+
+  if (!trained) {
     cout << "Error detected during training: " << error << endl;
     return;
   }
@@ -103,6 +223,7 @@ void ExecuteTraining(const string& output_filename) {
   uint32 elapsed_time = GetElapsedTimeMs(start_time);
 
   cout << "Training took " << elapsed_time / 1000.0f << " seconds." << endl;
+  PrintTreeTrainingTimes(forest.GetTreeTrainingTimes(), elapsed_time / 1000.0f);
 
   if (!SaveDecisionForest(output_filename, &forest, &error)) {
     cout << "Error detected while saving forest to disk: " << error << endl;
@@ -110,6 +231,246 @@ void ExecuteTraining(const string& output_filename) {
   }
 }
 
+// Trains shard (formatted as "index/count", with indices counting from
+// zero) of a forest. Every shard of a forest must use the same seed.
+void ExecuteShardTraining(const string& shard, const string& random_seed,
+                          const string& output_filename) {
+  uint32 shard_index = 0;
+  uint32 shard_count = 0;
+  uint32 seed = static_cast<uint32>(atoi(random_seed.c_str()));
+
+  if (2 != sscanf(shard.c_str(), "%u/%u", &shard_index, &shard_count) ||
+      shard_index >= shard_count) {
+    cout << "You must specify a valid shard, such as 3/8." << endl;
+    return;
+  }
+
+  if (!seed) {
+    cout << "You must specify the non-zero random seed shared by every shard."
+         << endl;
+    return;
+  }
+
+  ExecuteTraining(output_filename, "", shard_index, shard_count, seed);
+}
+
+void ExecuteMerge(const string& output_filename,
+                  const vector<string>& shard_filenames) {
+  string error;
+  vector<DecisionForest> shards(shard_filenames.size());
+  DecisionForest forest;
+
+  if (output_filename.empty() || shard_filenames.empty()) {
+    cout << "You must specify an output forest filename and one or more shard "
+            "filenames."
+         << endl;
+    return;
+  }
+
+  cout << "Loading forest shards..." << endl;
+
+  for (uint32 i = 0; i < shard_filenames.size(); i++) {
+    if (!LoadDecisionForest(shard_filenames[i], &shards[i], &error)) {
+      cout << "Error detected while loading forest from disk: " << error
+           << endl;
+      return;
+    }
+  }
+
+  if (!MergeDecisionForests(&shards, &forest, &error)) {
+    cout << "Error detected while merging forest shards: " << error << endl;
+    return;
+  }
+
+  cout << "Merged forest with the following parameters:" << endl;
+  PrintForestParams(forest.GetForestParams());
+  PrintTreeParams(forest.GetTreeParams());
+
+  if (!SaveDecisionForest(output_filename, &forest, &error)) {
+    cout << "Error detected while saving forest to disk: " << error << endl;
+    return;
+  }
+}
+
+void ExecuteGrowth(const string& forest_filename, const string& tree_count) {
+  string error;
+  uint32 label_count = 0;
+  uint32 new_tree_count = static_cast<uint32>(atoi(tree_count.c_str()));
+  Dataset training_data;
+  Dataset classify_data;
+  DecisionForest forest;
+
+  if (forest_filename.empty() || !new_tree_count) {
+    cout << "You must specify a valid forest filename and number of trees to "
+            "add."
+         << endl;
+    return;
+  }
+
+  cout << "Loading decision forest..." << endl;
+
+  if (!LoadDecisionForest(forest_filename, &forest, &error)) {
+    cout << "Error detected while loading forest from disk: " << error << endl;
+    return;
+  }
+
+  cout << "Loading training and test data..." << endl;
+
+  if (!LoadImageSet(mnist_training_images, mnist_training_labels,
+                    forest.GetTreeParams().visual_search_radius,
+                    &training_data, &label_count, &error) ||
+      !LoadImageSet(mnist_classify_images, mnist_classify_labels,
+                    forest.GetTreeParams().visual_search_radius,
+                    &classify_data, &label_count, &error)) {
+    cout << "Error detected during data load: " << error << endl;
+    return;
+  }
+
+  cout << "Training " << new_tree_count << " additional trees." << endl;
+
+  uint64 start_time = GetSystemTime();
+
+  if (!forest.Grow(new_tree_count, &training_data, &error)) {
+    cout << "Error detected during training: " << error << endl;
+    return;
+  }
+
+  uint32 elapsed_time = GetElapsedTimeMs(start_time);
+
+  cout << "Training took " << elapsed_time / 1000.0f << " seconds." << endl;
+
+  if (!AppendDecisionForest(forest_filename, &forest, &error)) {
+    cout << "Error detected while saving forest to disk: " << error << endl;
+    return;
+  }
+
+  float32 accuracy = 0.0f;
+
+  if (!MeasureAccuracy(&forest, classify_data, &accuracy, &error)) {
+    cout << "Error detected during classification: " << error << endl;
+    return;
+  }
+
+  cout << "Forest of " << forest.GetForestParams().total_tree_count
+       << " trees has an accuracy level of " << accuracy << "." << endl;
+}
+
+// Quantizes a forest, first ordering its nodes for the branches taken by
+// the specified number of MNIST training images (if any).
+void ExecuteQuantization(const string& input_filename,
+                         const string& output_filename,
+                         const string& calibration_count) {
+  string error;
+  uint32 label_count = 0;
+  uint32 calibration_image_count =
+      static_cast<uint32>(atoi(calibration_count.c_str()));
+  DecisionForest forest;
+  QuantizedForest quantized_forest;
+  QuantizedForest loaded_forest;
+  Dataset calibration_data;
+  Dataset classify_data;
+
+  if (input_filename.empty() || output_filename.empty()) {
+    cout << "You must specify valid input and output forest filenames." << endl;
+    return;
+  }
+
+  cout << "Loading decision forest..." << endl;
+
+  if (!LoadDecisionForest(input_filename, &forest, &error)) {
+    cout << "Error detected while loading forest from disk: " << error << endl;
+    return;
+  }
+
+  if (calibration_image_count) {
+    cout << "Optimizing node layout..." << endl;
+
+    if (!LoadImageSet(mnist_training_images, mnist_training_labels,
+                      forest.GetTreeParams().visual_search_radius,
+                      &calibration_data, &label_count, &error)) {
+      cout << "Error detected during data load: " << error << endl;
+      return;
+    }
+
+    if (calibration_image_count > calibration_data.GetImageCount()) {
+      calibration_image_count = calibration_data.GetImageCount();
+    }
+
+    if (!forest.OptimizeLayout(calibration_data, calibration_image_count,
+                               &error)) {
+      cout << "Error detected during layout optimization: " << error << endl;
+      return;
+    }
+  }
+
+  const CompiledForest* compiled_forest = forest.GetCompiledForest(&error);
+
+  // Posteriors are quantized to 8 bits, which is ample for a vote.
+  if (!compiled_forest ||
+      !quantized_forest.Quantize(*compiled_forest, forest.GetTreeParams(), 8,
+                                 &error)) {
+    cout << "Error detected during quantization: " << error << endl;
+    return;
+  }
+
+  cout << "Quantized forest from " << compiled_forest->GetSize() << " to "
+       << quantized_forest.GetSize() << " bytes." << endl;
+
+  // We measure the forest that we load, so that the report also covers
+  // serialization.
+  if (!SaveQuantizedForest(output_filename, &quantized_forest, &error) ||
+      !LoadQuantizedForest(output_filename, &loaded_forest, &error)) {
+    cout << "Error detected while saving forest to disk: " << error << endl;
+    return;
+  }
+
+  cout << "Loading test data..." << endl;
+
+  if (!LoadImageSet(mnist_classify_images, mnist_classify_labels,
+                    forest.GetTreeParams().visual_search_radius,
+                    &classify_data, &label_count, &error)) {
+    cout << "Error detected during data load: " << error << endl;
+    return;
+  }
+
+  float32 accuracy = 0.0f;
+  float32 quantized_accuracy = 0.0f;
+
+  if (!MeasureAccuracy(&forest, classify_data, &accuracy, &error) ||
+      !MeasureAccuracy(&loaded_forest, classify_data, &quantized_accuracy,
+                       &error)) {
+    cout << "Error detected during classification: " << error << endl;
+    return;
+  }
+
+  cout << "Forest accuracy level: " << accuracy << "." << endl;
+  cout << "Quantized forest accuracy level: " << quantized_accuracy
+       << ", a delta of " << quantized_accuracy - accuracy << "." << endl;
+}
+
+void ExecuteDatasetConversion(const string& output_filename) {
+  string error;
+  uint32 label_count = 0;
+  // Matches the visual_search_radius used by ExecuteTraining.
+  const uint32 border = 20;
+
+  if (output_filename.empty()) {
+    cout << "You must specify a valid dataset filename to write." << endl;
+    return;
+  }
+
+  cout << "Converting training data..." << endl;
+
+  if (!ConvertImageSet(mnist_training_images, mnist_training_labels, border,
+                       output_filename, &label_count, &error)) {
+    cout << "Error detected during conversion: " << error << endl;
+    return;
+  }
+
+  cout << "Wrote dataset with " << label_count << " labels to "
+       << output_filename << "." << endl;
+}
+
 void ExecuteClassification(const string& forest_filename,
                            const string& image_filename) {
   string error;
@@ -168,7 +529,7 @@ void ExecuteVerification(const string& input_filename) {
   string error;
   uint32 label_count = 0;
   DecisionForest forest;
-  vector<ImageSet> classify_data;
+  Dataset classify_data;
 
   if (input_filename.empty()) {
     cout << "You must specify a valid forest file to load for verification."
@@ -176,43 +537,108 @@ void ExecuteVerification(const string& input_filename) {
     return;
   }
 
+  cout << "Loading decision forest..." << endl;
+
+  if (!LoadDecisionForest(input_filename, &forest, &error)) {
+    cout << "Error detected while loading forest from disk: " << error << endl;
+    return;
+  }
+
+  cout << "Loaded forest with the following parameters:" << endl;
+  PrintForestParams(forest.GetForestParams());
+  PrintTreeParams(forest.GetTreeParams());
+
   cout << "Loading test data..." << endl;
 
+  // Test images are padded once, here, rather than on every classification.
   if (!LoadImageSet(mnist_classify_images, mnist_classify_labels,
+                    forest.GetTreeParams().visual_search_radius,
                     &classify_data, &label_count, &error)) {
     cout << "Error detected during data load: " << error << endl;
     return;
   }
 
-  cout << "Loaded " << classify_data.size() << " test samples." << endl;
+  cout << "Loaded " << classify_data.GetImageCount() << " test samples."
+       << endl;
 
-  cout << "Loading decision forest..." << endl;
+  float32 accuracy = 0.0f;
 
-  if (!LoadDecisionForest(input_filename, &forest, &error)) {
-    cout << "Error detected while loading forest from disk: " << error << endl;
+  if (!MeasureAccuracy(&forest, classify_data, &accuracy, &error)) {
+    cout << "Error detected during classification: " << error << endl;
     return;
   }
 
-  cout << "Loaded forest with the following parameters:" << endl;
-  PrintForestParams(forest.GetForestParams());
-  PrintTreeParams(forest.GetTreeParams());
+  cout << "Current forest accuracy level: " << accuracy << "." << endl;
+}
 
-  float32 total_correct = 0.0f;
+void ExecuteBenchmark(const string& tree_count) {
+  string error;
+  uint32 label_count = 0;
+  Dataset training_data;
+  Dataset classify_data;
+  DecisionForestParams forest_params = {};
+  DecisionTreeParams tree_params = {};
+  const uint32 split_criteria[] = {kSplitCriterionEntropy,
+                                   kSplitCriterionGini};
+  float32 accuracy[2] = {0.0f};
+  float32 seconds[2] = {0.0f};
+
+  forest_params.total_tree_count = atoi(tree_count.c_str());
+  forest_params.tree_training_percentage = 80;
+  tree_params.max_tree_depth = 20;
+  tree_params.node_trial_count = 1200;
+  tree_params.visual_search_radius = 20;
+  tree_params.min_sample_count = 2;
+
+  if (!forest_params.total_tree_count) {
+    cout << "You must specify a valid number of trees to benchmark." << endl;
+    return;
+  }
+
+  cout << "Loading training and test data..." << endl;
+
+  if (!LoadImageSet(mnist_training_images, mnist_training_labels,
+                    tree_params.visual_search_radius, &training_data,
+                    &label_count, &error) ||
+      !LoadImageSet(mnist_classify_images, mnist_classify_labels,
+                    tree_params.visual_search_radius, &classify_data,
+                    &label_count, &error)) {
+    cout << "Error detected during data load: " << error << endl;
+    return;
+  }
 
-  for (auto& data : classify_data) {
-    uint8 forest_result = forest.Classify(&data.image, &error);
-    uint8 ground_truth = data.codex;
+  tree_params.class_count = label_count;
 
-    if (error.length()) {
+  // Each criterion trains a forest from the same seed and training data.
+  for (uint32 i = 0; i < 2; i++) {
+    DecisionForest forest;
+    tree_params.split_criterion = split_criteria[i];
+
+    cout << "Training " << forest_params.total_tree_count << " trees with "
+         << GetSplitCriterionName(split_criteria[i]) << "..." << endl;
+
+    uint64 start_time = GetSystemTime();
+
+    if (!forest.Train(forest_params, tree_params, &training_data, &error)) {
+      cout << "Error detected during training: " << error << endl;
+      return;
+    }
+
+    seconds[i] = GetElapsedTimeMs(start_time) / 1000.0f;
+    forest_params.random_seed = forest.GetForestParams().random_seed;
+
+    if (!MeasureAccuracy(&forest, classify_data, &accuracy[i], &error)) {
       cout << "Error detected during classification: " << error << endl;
       return;
     }
 
-    total_correct += (forest_result == ground_truth);
+    cout << "  Training took " << seconds[i] << " seconds, accuracy level "
+         << accuracy[i] << "." << endl;
   }
 
-  cout << "Current forest accuracy level: "
-       << 100.0f * total_correct / classify_data.size() << "." << endl;
+  cout << "Gini trained in " << 100.0f * seconds[1] / seconds[0]
+       << "% of the time of entropy, with an accuracy delta of "
+       << accuracy[1] - accuracy[0] << "." << endl;
 }
 
 int main(int argc, char** argv) {
@@ -226,9 +652,20 @@ int main(int argc, char** argv) {
     for (int j = 0; j < 2; j++) (optBegin[0] == '-') ? optBegin++ : optBegin;
 
     switch (optBegin[0]) {
-      case 't':
-        ExecuteTraining(argv[++i]);
-        break;
+      case 't': {
+        if (!strcmp(optBegin, "train-shard")) {
+          if (argc < i + 4) {
+            PrintUsage(argv[0]);
+            return 0;
+          }
+          char* shard = argv[++i];
+          char* random_seed = argv[++i];
+          char* output_filename = argv[++i];
+          ExecuteShardTraining(shard, random_seed, output_filename);
+        } else {
+          ExecuteTraining(argv[++i], "");
+        }
+      } break;
       case 'c': {
         if (argc < 4) {
           PrintUsage(argv[0]);
@@ -241,6 +678,48 @@ int main(int argc, char** argv) {
       case 'v':
         ExecuteVerification(argv[++i]);
         break;
+      case 'b':
+        ExecuteBenchmark(argv[++i]);
+        break;
+      case 'd':
+        ExecuteDatasetConversion(argv[++i]);
+        break;
+      case 's': {
+        if (argc < 4) {
+          PrintUsage(argv[0]);
+          return 0;
+        }
+        char* dataset_filename = argv[++i];
+        char* output_filename = argv[++i];
+        ExecuteTraining(output_filename, dataset_filename);
+      } break;
+      case 'g': {
+        if (argc < i + 3) {
+          PrintUsage(argv[0]);
+          return 0;
+        }
+        char* forest_filename = argv[++i];
+        char* tree_count = argv[++i];
+        ExecuteGrowth(forest_filename, tree_count);
+      } break;
+      case 'q': {
+        if (argc < i + 4) {
+          PrintUsage(argv[0]);
+          return 0;
+        }
+        char* input_filename = argv[++i];
+        char* output_filename = argv[++i];
+        char* calibration_count = argv[++i];
+        ExecuteQuantization(input_filename, output_filename,
+                            calibration_count);
+      } break;
+      case 'm': {
+        // The remaining arguments are all shards.
+        char* output_filename = argv[++i];
+        vector<string> shard_filenames(argv + i + 1, argv + argc);
+        i = argc;
+        ExecuteMerge(output_filename, shard_filenames);
+      } break;
     }
   }
 
@@ -0,0 +1,358 @@
+#include "quantized.h"
+
+#include "numeric.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define ENABLE_SSE2 (1)
+#include <emmintrin.h>
+#endif
+
+namespace base {
+
+// Widens and adds lane_count 8 bit posteriors to target.
+void AddBytePosteriors(const uint8* source, uint32 lane_count,
+                       uint32* target) {
+#if ENABLE_SSE2
+  __m128i zero = _mm_setzero_si128();
+
+  for (uint32 i = 0; i < lane_count; i += kHistogramLaneCount) {
+    __m128i* output = (__m128i*)(target + i);
+    __m128i input = _mm_cvtsi32_si128(*(const int32*)(source + i));
+    input = _mm_unpacklo_epi16(_mm_unpacklo_epi8(input, zero), zero);
+    _mm_storeu_si128(output, _mm_add_epi32(_mm_loadu_si128(output), input));
+  }
+#else
+  for (uint32 i = 0; i < lane_count; i++) {
+    target[i] += source[i];
+  }
+#endif
+}
+
+// Widens and adds lane_count 16 bit posteriors to target.
+void AddShortPosteriors(const uint16* source, uint32 lane_count,
+                        uint32* target) {
+#if ENABLE_SSE2
+  __m128i zero = _mm_setzero_si128();
+
+  for (uint32 i = 0; i < lane_count; i += kHistogramLaneCount) {
+    __m128i* output = (__m128i*)(target + i);
+    __m128i input = _mm_loadl_epi64((const __m128i*)(source + i));
+    input = _mm_unpacklo_epi16(input, zero);
+    _mm_storeu_si128(output, _mm_add_epi32(_mm_loadu_si128(output), input));
+  }
+#else
+  for (uint32 i = 0; i < lane_count; i++) {
+    target[i] += source[i];
+  }
+#endif
+}
+
+// Returns the bit that marks a leaf link of the specified type.
+template <typename Link>
+Link GetLeafLinkBit() {
+  return Link(1) << (sizeof(Link) * 8 - 1);
+}
+
+// Converts the links of a compiled node into quantized links.
+template <typename Link>
+void SetChildLinks(const CompiledNode& input, uint32 node_index,
+                   uint32 leaf_start, QuantizedNode<Link>* output) {
+  for (uint32 i = 0; i < 2; i++) {
+    uint32 link = input.child_links[i];
+    output->child_links[i] =
+        (link & kCompiledLeafLink)
+            ? Link(((link & ~kCompiledLeafLink) - leaf_start) |
+                   GetLeafLinkBit<Link>())
+            : Link(link - node_index);
+  }
+}
+
+bool QuantizedForest::Quantize(const CompiledForest& input,
+                               const DecisionTreeParams& tree_params,
+                               uint32 posterior_bits, string* error) {
+  Clear();
+
+  if (input.IsEmpty() || (8 != posterior_bits && 16 != posterior_bits)) {
+    if (error) {
+      *error = "Invalid parameter(s) specified to QuantizedForest::Quantize.";
+    }
+    return false;
+  }
+
+  // Each tree's nodes and leaves are contiguous, and its first leaf is the
+  // leaf with the lowest index that it reaches. Leaf links are relative to
+  // it, and node links to the node holding them, which must precede its
+  // children. This keeps links small enough to fit 16 bits in all but the
+  // largest trees.
+  uint32 node_count = input.nodes_.size();
+  uint32 largest_link = 0;
+  vector<uint32> node_leaf_starts(node_count, 0);
+
+  for (auto root_link : input.tree_links_) {
+    uint32 leaf_start = 0xFFFFFFFF;
+    vector<uint32> link_stack(1, root_link);
+
+    for (uint32 pass = 0; pass < 2; pass++) {
+      link_stack.assign(1, root_link);
+
+      while (!link_stack.empty()) {
+        uint32 link = link_stack.back();
+        link_stack.pop_back();
+
+        if (link & kCompiledLeafLink) {
+          uint32 leaf_index = link & ~kCompiledLeafLink;
+          leaf_start = leaf_index < leaf_start ? leaf_index : leaf_start;
+          continue;
+        }
+
+        const CompiledNode& node = input.nodes_[link];
+
+        for (uint32 i = 0; i < 2; i++) {
+          uint32 child_link = node.child_links[i];
+
+          if (!(child_link & kCompiledLeafLink) && child_link <= link) {
+            if (error) {
+              *error = "Compiled forest nodes must precede their children.";
+            }
+            Clear();
+            return false;
+          }
+
+          // Our first pass finds the tree's first leaf, and our second
+          // measures its links.
+          if (pass) {
+            uint32 distance = (child_link & kCompiledLeafLink)
+                                  ? (child_link & ~kCompiledLeafLink) -
+                                        leaf_start
+                                  : child_link - link;
+            largest_link = distance > largest_link ? distance : largest_link;
+            node_leaf_starts[link] = leaf_start;
+          }
+
+          link_stack.push_back(child_link);
+        }
+      }
+    }
+
+    tree_links_.push_back((root_link & kCompiledLeafLink)
+                              ? (root_link - leaf_start)
+                              : root_link);
+    tree_leaf_starts_.push_back(leaf_start);
+  }
+
+  tree_params_ = tree_params;
+  lane_count_ = input.lane_count_;
+  posterior_bits_ = posterior_bits;
+
+  for (uint32 i = 0; i < node_count; i++) {
+    const CompiledNode& node = input.nodes_[i];
+    const SplitCoord* probes = &input.probe_offsets_[2 * i];
+    int32 offsets[4] = {probes[0].x, probes[0].y, probes[1].x, probes[1].y};
+
+    for (uint32 j = 0; j < 4; j++) {
+      if (offsets[j] < -127 || offsets[j] > 127) {
+        if (error) {
+          *error = "Split offsets exceed the range of a quantized forest.";
+        }
+        Clear();
+        return false;
+      }
+
+      probe_offsets_.push_back(static_cast<int8>(offsets[j]));
+    }
+
+    if (largest_link < 0x8000) {
+      ShortQuantizedNode quantized_node = {{0}, int16(node.threshold), {0}};
+      SetChildLinks(node, i, node_leaf_starts[i], &quantized_node);
+      short_nodes_.push_back(quantized_node);
+    } else {
+      LongQuantizedNode quantized_node = {{0}, int16(node.threshold), {0}};
+      SetChildLinks(node, i, node_leaf_starts[i], &quantized_node);
+      long_nodes_.push_back(quantized_node);
+    }
+  }
+
+  // Posteriors are rounded to the nearest fixed point value.
+  uint32 posterior_scale = (1 << posterior_bits) - 1;
+  uint32 posterior_count = input.leaf_posteriors_.size();
+
+  leaf_posteriors_.resize(posterior_count * posterior_bits / 8);
+
+  for (uint32 i = 0; i < posterior_count; i++) {
+    uint32 value = static_cast<uint32>(
+        input.leaf_posteriors_[i] * posterior_scale + 0.5f);
+
+    if (16 == posterior_bits) {
+      reinterpret_cast<uint16*>(leaf_posteriors_.data())[i] = uint16(value);
+    } else {
+      leaf_posteriors_[i] = uint8(value);
+    }
+  }
+
+  return true;
+}
+
+void QuantizedForest::Clear() {
+  lane_count_ = 0;
+  posterior_bits_ = 0;
+  short_nodes_.clear();
+  long_nodes_.clear();
+  probe_offsets_.clear();
+  tree_links_.clear();
+  tree_leaf_starts_.clear();
+  leaf_posteriors_.clear();
+  bound_width_ = 0;
+  bound_height_ = 0;
+  bound_row_stride_ = 0;
+}
+
+uint64 QuantizedForest::GetSize() const {
+  return short_nodes_.size() * sizeof(ShortQuantizedNode) +
+         long_nodes_.size() * sizeof(LongQuantizedNode) +
+         leaf_posteriors_.size();
+}
+
+// Resolves the byte offsets of each node from its four probe offsets,
+// limiting each coordinate to the specified reach.
+template <typename Link>
+void BindNodes(const vector<int8>& probe_offsets, int32 reach_x,
+               int32 reach_y, int32 row_stride,
+               vector<QuantizedNode<Link>>* nodes) {
+  for (uint32 i = 0; i < nodes->size(); i++) {
+    const int8* probes = &probe_offsets[4 * i];
+
+    for (uint32 j = 0; j < 2; j++) {
+      int32 x = clip_range(probes[2 * j], -reach_x, reach_x);
+      int32 y = clip_range(probes[2 * j + 1], -reach_y, reach_y);
+      nodes->at(i).offsets[j] = static_cast<int16>(y * row_stride + x);
+    }
+  }
+}
+
+bool QuantizedForest::Bind(uint32 width, uint32 height, uint32 row_stride,
+                           string* error) {
+  if (width == bound_width_ && height == bound_height_ &&
+      row_stride == bound_row_stride_) {
+    return true;
+  }
+
+  // Offsets are limited to half of each dimension (see GetPaddedOffset).
+  // Trained offsets never exceed our search radius, so we also limit them
+  // to it, which keeps every probe within a sufficient border (see
+  // Dataset::IsBorderSufficient) even if a file was damaged.
+  int32 radius = tree_params_.visual_search_radius;
+  int32 reach_x = clip_range(width >> 0x1, 0, radius);
+  int32 reach_y = clip_range(height >> 0x1, 0, radius);
+
+  if (int64(reach_y) * row_stride + reach_x > 0x7FFF) {
+    if (error) {
+      *error = "Image rows are too wide for a quantized forest.";
+    }
+    return false;
+  }
+
+  BindNodes(probe_offsets_, reach_x, reach_y, row_stride, &short_nodes_);
+  BindNodes(probe_offsets_, reach_x, reach_y, row_stride, &long_nodes_);
+
+  bound_width_ = width;
+  bound_height_ = height;
+  bound_row_stride_ = row_stride;
+  return true;
+}
+
+void QuantizedForest::AddLeafPosteriors(uint32 leaf_index,
+                                        uint32* totals) const {
+  if (16 == posterior_bits_) {
+    AddShortPosteriors(reinterpret_cast<const uint16*>(
+                           leaf_posteriors_.data()) + leaf_index * lane_count_,
+                       lane_count_, totals);
+  } else {
+    AddBytePosteriors(&leaf_posteriors_[leaf_index * lane_count_], lane_count_,
+                      totals);
+  }
+}
+
+template <typename Link>
+void QuantizedForest::AccumulateVotes(const vector<QuantizedNode<Link>>& nodes,
+                                      const uint8* sample,
+                                      uint32* totals) const {
+  const Link leaf_link_bit = GetLeafLinkBit<Link>();
+
+  for (uint32 i = 0; i < tree_links_.size(); i++) {
+    uint32 link = tree_links_[i];
+
+    if (link & kCompiledLeafLink) {
+      link &= ~kCompiledLeafLink;
+    } else {
+      // Walk down from the root until we reach a leaf link.
+      for (uint32 node_index = link;;) {
+        const QuantizedNode<Link>& node = nodes[node_index];
+        int32 difference =
+            int32(sample[node.offsets[1]]) - sample[node.offsets[0]];
+        Link child_link = node.child_links[difference > node.threshold];
+
+        if (child_link & leaf_link_bit) {
+          link = child_link & ~leaf_link_bit;
+          break;
+        }
+
+        node_index += child_link;
+      }
+    }
+
+    AddLeafPosteriors(tree_leaf_starts_[i] + link, totals);
+  }
+}
+
+uint8 QuantizedForest::Classify(const Dataset& input, uint32 index,
+                                string* error) {
+  if (index >= input.GetImageCount() ||
+      !input.IsBorderSufficient(tree_params_.visual_search_radius)) {
+    if (error) {
+      *error = "Invalid parameter(s) specified to QuantizedForest::Classify.";
+    }
+    return kBackgroundClassLabel;
+  }
+
+  if (IsEmpty()) {
+    if (error) {
+      *error = "Quantized forest must be quantized before it can classify.";
+    }
+    return kBackgroundClassLabel;
+  }
+
+  if (!Bind(input.GetWidth(), input.GetHeight(), input.GetRowStride(),
+            error)) {
+    return kBackgroundClassLabel;
+  }
+
+  // As in DecisionForest::Classify, each pixel votes for its dominant
+  // class, and the image takes the dominant non-background class.
+  Histogram image_result(tree_params_.class_count);
+  uint32 totals[kMaxClassCount];
+  uint32 row_stride = input.GetRowStride();
+  const uint8* image_data = input.GetImageData(index);
+
+  for (uint32 j = 0; j < input.GetHeight(); j++) {
+    for (uint32 i = 0; i < input.GetWidth(); i++) {
+      const uint8* sample = image_data + j * row_stride + i;
+
+      memset(totals, 0, lane_count_ * sizeof(uint32));
+
+      if (short_nodes_.size()) {
+        AccumulateVotes(short_nodes_, sample, totals);
+      } else {
+        AccumulateVotes(long_nodes_, sample, totals);
+      }
+
+      image_result.IncrementValue(FindDominantClass(totals, lane_count_));
+    }
+  }
+
+  image_result.ClearClass(kBackgroundClassLabel);
+
+  return image_result.GetDominantClass();
+}
+
+}  // namespace base
\ No newline at end of file
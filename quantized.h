@@ -0,0 +1,133 @@
+/*
+//
+// Copyright (c) 1998-2019 Joe Bertolami. All Right Reserved.
+//
+//   Redistribution and use in source and binary forms, with or without
+//   modification, are permitted provided that the following conditions are met:
+//
+//   * Redistributions of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//
+//   * Redistributions in binary form must reproduce the above copyright notice,
+//     this list of conditions and the following disclaimer in the documentation
+//     and/or other materials provided with the distribution.
+//
+//   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+//   AND ANY EXPRESS OR IMPLIED WARRANTIES, CLUDG, BUT NOT LIMITED TO, THE
+//   IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+//   ARE DISCLAIMED.  NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+//   LIABLE FOR ANY DIRECT, DIRECT, CIDENTAL, SPECIAL, EXEMPLARY, OR
+//   CONSEQUENTIAL DAMAGES (CLUDG, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+//   GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSESS TERRUPTION)
+//   HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER  CONTRACT, STRICT
+//   LIABILITY, OR TORT (CLUDG NEGLIGENCE OR OTHERWISE) ARISG  ANY WAY  OF THE
+//   USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// Additional Information:
+//
+//   For more information, visit http://www.bertolami.com.
+//
+*/
+
+#ifndef __QUANTIZED_H__
+#define __QUANTIZED_H__
+
+#include <fstream>
+#include <vector>
+
+#include "base_types.h"
+#include "compiled.h"
+#include "dataset.h"
+#include "tree.h"
+
+using ::std::ifstream;
+using ::std::ofstream;
+using ::std::vector;
+
+namespace base {
+
+// A split node of a quantized tree. Nodes use 16 bit child links if every
+// link of the forest fits, or 32 bit links otherwise.
+template <typename Link>
+struct QuantizedNode {
+  // The byte offsets, relative to the sample, of the two probes compared by
+  // the node's split function, as bound for the layout of the images being
+  // classified.
+  int16 offsets[2];
+  // Samples whose probe difference exceeds this go right.
+  int16 threshold;
+  // The left and right child links. Node links hold the distance from this
+  // node to the child, which always follows it. Leaf links hold the leaf's
+  // index within its tree, combined with the top bit of the link.
+  Link child_links[2];
+};
+
+typedef QuantizedNode<uint16> ShortQuantizedNode;
+typedef QuantizedNode<uint32> LongQuantizedNode;
+
+// A compact, read-only copy of a compiled forest for classification, with
+// probe offsets stored as 8 bit coordinates (offsets never exceed the
+// search radius, which is at most 127) and leaf posteriors stored as 8 or
+// 16 bit fixed point values. A quantized forest is several times smaller
+// than a compiled forest, so that more of it remains in cache, at the cost
+// of a small loss of posterior precision.
+class QuantizedForest {
+ public:
+  // Quantizes input, whose trees were trained with tree_params, storing
+  // posteriors with posterior_bits (8 or 16) bits.
+  bool Quantize(const CompiledForest& input,
+                const DecisionTreeParams& tree_params, uint32 posterior_bits,
+                string* error = nullptr);
+  // Releases our trees.
+  void Clear();
+  bool IsEmpty() const { return tree_links_.empty(); }
+  // Classifies an image within a dataset and returns the dominant class
+  // index, exactly as DecisionForest::Classify does.
+  uint8 Classify(const Dataset& input, uint32 index, string* error = nullptr);
+  // Returns the params used to construct each tree in the forest.
+  DecisionTreeParams GetTreeParams() const { return tree_params_; }
+  // Queries the number of bytes used by our nodes and leaf posteriors.
+  uint64 GetSize() const;
+
+ private:
+  // Resolves our probe offsets for images of the specified dimensions and
+  // row stride. Fails if an offset does not fit within 16 bits.
+  bool Bind(uint32 width, uint32 height, uint32 row_stride,
+            string* error = nullptr);
+  // Adds the posteriors of the leaf that sample reaches within each tree
+  // to totals, which holds lane_count_ values.
+  template <typename Link>
+  void AccumulateVotes(const vector<QuantizedNode<Link>>& nodes,
+                       const uint8* sample, uint32* totals) const;
+  // Adds the posteriors of a leaf to totals.
+  void AddLeafPosteriors(uint32 leaf_index, uint32* totals) const;
+
+  DecisionTreeParams tree_params_;
+  // The number of posteriors stored for each leaf.
+  uint32 lane_count_ = 0;
+  uint32 posterior_bits_ = 0;
+  // Our split nodes. Only one of these is populated.
+  vector<ShortQuantizedNode> short_nodes_;
+  vector<LongQuantizedNode> long_nodes_;
+  // The probe offsets (x0, y0, x1, y1) of each node, four per node.
+  vector<int8> probe_offsets_;
+  // The link to the root of each tree, which is either the index of its
+  // first node or a leaf link, and the index of each tree's first leaf.
+  vector<uint32> tree_links_;
+  vector<uint32> tree_leaf_starts_;
+  // lane_count_ posteriors, of posterior_bits_ bits each, for each leaf.
+  vector<uint8> leaf_posteriors_;
+  // The layout that our nodes are bound to.
+  uint32 bound_width_ = 0;
+  uint32 bound_height_ = 0;
+  uint32 bound_row_stride_ = 0;
+  // Provide access to our serialization API.
+  friend bool SaveQuantizedForest(const string& filename,
+                                  QuantizedForest* input, string* error);
+  friend bool LoadQuantizedForest(const string& filename,
+                                  QuantizedForest* output, string* error);
+};
+
+}  // namespace base
+
+#endif  // __QUANTIZED_H__
\ No newline at end of file
@@ -3,41 +3,68 @@
 
 namespace base {
 
-thread_local uint64 g_random_seed = 521288629;
+RandomGenerator::RandomGenerator() { state_ = 521288629; }
 
-void set_seed(uint64 seed) { g_random_seed = seed; }
+RandomGenerator::RandomGenerator(uint64 seed) { SetSeed(seed); }
 
-uint64 random_integer() {
+void RandomGenerator::SetSeed(uint64 seed) {
+  // SplitMix64 finalizer. See http://xorshift.di.unimi.it/splitmix64.c.
+  uint64 z = seed + 0x9E3779B97F4A7C15;
+  z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9;
+  z = (z ^ (z >> 27)) * 0x94D049BB133111EB;
+  z = z ^ (z >> 31);
+
+  // Xorshift must never be seeded with zero.
+  state_ = z ? z : 521288629;
+}
+
+uint64 RandomGenerator::Integer() {
   // Pseudo random number generator invented by by George Marsaglia.
   // See https://en.wikipedia.org/wiki/Xorshift.
-  uint64 x = g_random_seed;
+  uint64 x = state_;
   x ^= x << 12;
   x ^= x >> 25;
   x ^= x << 27;
-  g_random_seed = x;
+  state_ = x;
   return x * 0x2545F4914F6CDD1D;
 }
 
-float32 random_float() {
-  return ((float32)(random_integer() % BASE_MAX_INT32)) / BASE_MAX_INT32;
+float32 RandomGenerator::Float() {
+  return ((float32)(Integer() % BASE_MAX_INT32)) / BASE_MAX_INT32;
 }
 
-int64 random_integer_range(int32 imin, int32 imax) {
+int64 RandomGenerator::IntegerRange(int32 imin, int32 imax) {
   if (imax < imin) {
     return 0;
   }
 
   if (imin == imax) return imin;
   uint32 span = (imax - imin) + 1;
-  return ((int32)imin + (random_integer() % span));
+  return ((int32)imin + (Integer() % span));
 }
 
-float32 random_float_range(float32 imin, float32 imax) {
+float32 RandomGenerator::FloatRange(float32 imin, float32 imax) {
   if (imax < imin) {
     return 0.0f;
   }
 
-  return imin + random_float() * (imax - imin);
+  return imin + Float() * (imax - imin);
+}
+
+thread_local RandomGenerator g_random_generator;
+
+void set_seed(uint64 seed) { g_random_generator.SetSeed(seed); }
+
+uint64 random_integer() { return g_random_generator.Integer(); }
+
+float32 random_float() { return g_random_generator.Float(); }
+
+int64 random_integer_range(int32 imin, int32 imax) {
+  return g_random_generator.IntegerRange(imin, imax);
+}
+
+float32 random_float_range(float32 imin, float32 imax) {
+  return g_random_generator.FloatRange(imin, imax);
 }
 
 }  // namespace base
\ No newline at end of file
@@ -36,9 +36,34 @@
 
 namespace base {
 
+// A xorshift pseudo random number generator that owns its state. Training
+// gives each tree (and each concurrently trained subtree) its own generator,
+// so results depend only on the seed and not on thread scheduling.
+class RandomGenerator {
+ public:
+  RandomGenerator();
+  // Initializes the generator with SetSeed(seed).
+  explicit RandomGenerator(uint64 seed);
+  // Scrambles seed into our state, so that nearby seeds (e.g. a master seed
+  // plus a tree index) produce unrelated streams.
+  void SetSeed(uint64 seed);
+
+  uint64 Integer();  // Returns a range of 0...BASE_MAX_UINT64
+  float32 Float();   // Returns a range of 0...1
+
+  int64 IntegerRange(int32 imin, int32 imax);
+  float32 FloatRange(float32 imin, float32 imax);
+
+ private:
+  uint64 state_;
+};
+
+// The functions below operate on a generator that is local to the calling
+// thread.
+
 void set_seed(uint64 ui_seed);
 
-uint64 random_integer();  // Returns a range of 0...BASE_MAX_UINT32
+uint64 random_integer();  // Returns a range of 0...BASE_MAX_UINT64
 float32 random_float();   // Returns a range of 0...1
 
 int64 random_integer_range(int32 imin, int32 imax);
@@ -0,0 +1,198 @@
+#include "scheduler.h"
+
+namespace base {
+
+// Identifies the scheduler and worker (if any) of the current thread.
+thread_local TaskScheduler *g_current_scheduler = nullptr;
+thread_local uint32 g_current_worker_index = 0;
+
+TaskScheduler::TaskScheduler() : queued_task_count_(0), shutdown_(false) {}
+
+TaskScheduler::~TaskScheduler() { Shutdown(); }
+
+bool TaskScheduler::Initialize(uint32 worker_count, string *error) {
+  if (!task_queues_.empty()) {
+    if (error) {
+      *error = "Task scheduler has already been initialized.";
+    }
+    return false;
+  }
+
+  shutdown_ = false;
+
+  for (uint32 i = 0; i < worker_count + 2; i++) {
+    task_queues_.emplace_back(new TaskQueue);
+  }
+
+  for (uint32 i = 0; i < worker_count; i++) {
+    workers_.emplace_back(&TaskScheduler::WorkerFunction, this, i);
+  }
+
+  return true;
+}
+
+void TaskScheduler::Shutdown() {
+  {
+    ::std::lock_guard<::std::mutex> lock(sleep_mutex_);
+    shutdown_ = true;
+  }
+
+  idle_condition_.notify_all();
+
+  for (auto &worker : workers_) {
+    worker.join();
+  }
+
+  workers_.clear();
+  task_queues_.clear();
+}
+
+void TaskScheduler::Spawn(TaskGroup *group, const Task &task) {
+  TaskQueue *queue = task_queues_.at(task_queues_.size() - 2).get();
+
+  if (this == g_current_scheduler) {
+    queue = task_queues_.at(g_current_worker_index).get();
+  }
+
+  QueueTask(queue, group, task);
+}
+
+void TaskScheduler::SpawnRoot(TaskGroup *group, const Task &task) {
+  QueueTask(task_queues_.back().get(), group, task);
+}
+
+void TaskScheduler::Wait(TaskGroup *group) {
+  QueuedTask task;
+
+  while (group->pending_count_) {
+    if (FindTask(group, &task)) {
+      RunTask(&task);
+      continue;
+    }
+
+    ::std::unique_lock<::std::mutex> lock(sleep_mutex_);
+    wait_condition_.wait(lock, [&] {
+      return !group->pending_count_ || group->queued_count_ > 0;
+    });
+  }
+}
+
+uint32 TaskScheduler::GetWorkerCount() const { return workers_.size(); }
+
+void TaskScheduler::QueueTask(TaskQueue *queue, TaskGroup *group,
+                              const Task &task) {
+  group->pending_count_++;
+  group->queued_count_++;
+
+  {
+    ::std::lock_guard<::std::mutex> lock(queue->mutex);
+    queue->tasks.push_back({task, group});
+  }
+
+  queued_task_count_++;
+
+  // Take the sleep lock so that a thread about to sleep cannot miss us.
+  {
+    ::std::lock_guard<::std::mutex> lock(sleep_mutex_);
+  }
+  idle_condition_.notify_one();
+}
+
+bool TaskScheduler::TakeTask(TaskQueue *queue, TaskGroup *group, bool newest,
+                             QueuedTask *output) {
+  ::std::lock_guard<::std::mutex> lock(queue->mutex);
+  uint32 task_count = queue->tasks.size();
+
+  for (uint32 i = 0; i < task_count; i++) {
+    uint32 index = newest ? task_count - 1 - i : i;
+
+    if (group && group != queue->tasks[index].group) {
+      continue;
+    }
+
+    *output = ::std::move(queue->tasks[index]);
+    queue->tasks.erase(queue->tasks.begin() + index);
+    output->group->queued_count_--;
+    queued_task_count_--;
+    return true;
+  }
+
+  return false;
+}
+
+bool TaskScheduler::FindTask(TaskGroup *group, QueuedTask *output) {
+  uint32 shared_index = task_queues_.size() - 2;
+  uint32 root_index = shared_index + 1;
+  bool is_worker = (this == g_current_scheduler);
+
+  // Workers drain their own queue newest first. Every task that a waiting
+  // worker spawned after those of its group has completed, so the newest
+  // tasks in its queue are those of its group.
+  if (is_worker && TakeTask(task_queues_.at(g_current_worker_index).get(),
+                            group, true, output)) {
+    return true;
+  }
+
+  // Threads outside of the scheduler queue their tasks in the shared and
+  // root queues.
+  if (group) {
+    return !is_worker &&
+           (TakeTask(task_queues_.at(shared_index).get(), group, true,
+                     output) ||
+            TakeTask(task_queues_.at(root_index).get(), group, false,
+                     output));
+  }
+
+  // Idle workers take the oldest task from the shared queue or another
+  // worker, starting with the shared queue, and only then start a new root
+  // task.
+  for (uint32 i = 0; i < root_index; i++) {
+    uint32 index = (shared_index + i) % root_index;
+
+    if (is_worker && index == g_current_worker_index) {
+      continue;
+    }
+
+    if (TakeTask(task_queues_.at(index).get(), nullptr, false, output)) {
+      return true;
+    }
+  }
+
+  return TakeTask(task_queues_.at(root_index).get(), nullptr, false, output);
+}
+
+void TaskScheduler::RunTask(QueuedTask *task) {
+  task->task();
+
+  if (0 == --task->group->pending_count_) {
+    // Wake any thread waiting on this group.
+    {
+      ::std::lock_guard<::std::mutex> lock(sleep_mutex_);
+    }
+    wait_condition_.notify_all();
+  }
+}
+
+void TaskScheduler::WorkerFunction(uint32 worker_index) {
+  g_current_scheduler = this;
+  g_current_worker_index = worker_index;
+
+  QueuedTask task;
+
+  while (true) {
+    if (FindTask(nullptr, &task)) {
+      RunTask(&task);
+      continue;
+    }
+
+    ::std::unique_lock<::std::mutex> lock(sleep_mutex_);
+    idle_condition_.wait(
+        lock, [&] { return shutdown_ || queued_task_count_ > 0; });
+
+    if (shutdown_) {
+      return;
+    }
+  }
+}
+
+}  // namespace base
\ No newline at end of file
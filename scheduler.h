@@ -0,0 +1,138 @@
+/*
+//
+// Copyright (c) 1998-2019 Joe Bertolami. All Right Reserved.
+//
+//   Redistribution and use in source and binary forms, with or without
+//   modification, are permitted provided that the following conditions are met:
+//
+//   * Redistributions of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//
+//   * Redistributions in binary form must reproduce the above copyright notice,
+//     this list of conditions and the following disclaimer in the documentation
+//     and/or other materials provided with the distribution.
+//
+//   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+//   AND ANY EXPRESS OR IMPLIED WARRANTIES, CLUDG, BUT NOT LIMITED TO, THE
+//   IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+//   ARE DISCLAIMED.  NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+//   LIABLE FOR ANY DIRECT, DIRECT, CIDENTAL, SPECIAL, EXEMPLARY, OR
+//   CONSEQUENTIAL DAMAGES (CLUDG, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+//   GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSESS TERRUPTION)
+//   HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER  CONTRACT, STRICT
+//   LIABILITY, OR TORT (CLUDG NEGLIGENCE OR OTHERWISE) ARISG  ANY WAY  OF THE
+//   USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// Additional Information:
+//
+//   For more information, visit http://www.bertolami.com.
+//
+*/
+
+#ifndef __SCHEDULER_H__
+#define __SCHEDULER_H__
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "base_types.h"
+
+using ::std::unique_ptr;
+using ::std::vector;
+
+namespace base {
+
+// Tracks the completion of a set of related tasks.
+class TaskGroup {
+ public:
+  TaskGroup() : pending_count_(0), queued_count_(0) {}
+
+ private:
+  // The number of spawned tasks that have yet to complete.
+  ::std::atomic<uint32> pending_count_;
+  // The number of spawned tasks that have yet to start.
+  ::std::atomic<uint32> queued_count_;
+  friend class TaskScheduler;
+};
+
+// A work stealing task scheduler. Each worker thread owns a deque of tasks.
+// Tasks spawned by a worker are pushed to and popped from the back of its
+// own deque, so workers proceed depth first through the work they create,
+// while idle workers steal from the front of other deques, where the oldest
+// (and typically largest) tasks reside. Tasks spawned by threads outside of
+// the scheduler are placed in a shared queue.
+//
+// A thread that waits on a task group only runs tasks of that group, so
+// unrelated work never starts nested inside a waiting task (where it would
+// hold the waiting task's memory until it completes). Root tasks, such as
+// entire trees, sit in their own queue, which idle workers only visit once
+// there is nothing left to steal.
+class TaskScheduler {
+ public:
+  typedef ::std::function<void()> Task;
+
+  TaskScheduler();
+  ~TaskScheduler();
+  // Starts worker_count worker threads. Threads that wait on a task group
+  // also execute its tasks, so zero workers is valid.
+  bool Initialize(uint32 worker_count, string *error = nullptr);
+  // Stops all worker threads. Outstanding tasks must have been waited on.
+  void Shutdown();
+  // Queues a task as a member of group.
+  void Spawn(TaskGroup *group, const Task &task);
+  // Queues a root task as a member of group. Root tasks are started by idle
+  // workers, or by a thread that waits on group.
+  void SpawnRoot(TaskGroup *group, const Task &task);
+  // Waits for all tasks in group to complete. The calling thread executes
+  // queued tasks of group, newest first, while it waits.
+  void Wait(TaskGroup *group);
+  // Returns the number of worker threads.
+  uint32 GetWorkerCount() const;
+
+ private:
+  typedef struct QueuedTask {
+    Task task;
+    TaskGroup *group;
+  } QueuedTask;
+
+  typedef struct TaskQueue {
+    ::std::mutex mutex;
+    ::std::deque<QueuedTask> tasks;
+  } TaskQueue;
+
+  // Queues a task as a member of group, at the back of queue.
+  void QueueTask(TaskQueue *queue, TaskGroup *group, const Task &task);
+  // Removes a task of group (or any task, if group is null) from queue,
+  // searching from its back if newest is true and from its front otherwise.
+  bool TakeTask(TaskQueue *queue, TaskGroup *group, bool newest,
+                QueuedTask *output);
+  // Retrieves a task of group for the calling thread, or any task if group
+  // is null. Returns false if none exist.
+  bool FindTask(TaskGroup *group, QueuedTask *output);
+  // Executes a task and signals its group.
+  void RunTask(QueuedTask *task);
+  // Main loop of each worker thread.
+  void WorkerFunction(uint32 worker_index);
+
+  // One queue per worker, followed by the shared queue and the root queue.
+  vector<unique_ptr<TaskQueue>> task_queues_;
+  vector<::std::thread> workers_;
+  // The number of tasks sitting in any queue.
+  ::std::atomic<uint32> queued_task_count_;
+  // Idle workers sleep until tasks are queued, and waiting threads sleep
+  // until tasks of their group are queued or their group completes.
+  ::std::mutex sleep_mutex_;
+  ::std::condition_variable idle_condition_;
+  ::std::condition_variable wait_condition_;
+  bool shutdown_;
+};
+
+}  // namespace base
+
+#endif  // __SCHEDULER_H__
\ No newline at end of file
@@ -2,30 +2,36 @@
 #include "split.h"
 
 #include "numeric.h"
-#include "random.h"
 
 namespace base {
 
-void SplitFunction::Initialize(int32 max_search_radius) {
-  uint32 count = random_integer_range(1, 2);
+void SplitFunction::Initialize(int32 max_search_radius,
+                               RandomGenerator* random) {
+  uint32 count = random->IntegerRange(1, 2);
 
   params_.clear();
+  threshold_ = 0;
 
   for (uint32 i = 0; i < count; i++) {
     SplitCoord param_offset;
     param_offset.x =
-        random_integer_range(-max_search_radius, max_search_radius);
+        random->IntegerRange(-max_search_radius, max_search_radius);
     param_offset.y =
-        random_integer_range(-max_search_radius, max_search_radius);
+        random->IntegerRange(-max_search_radius, max_search_radius);
     params_.push_back(param_offset);
   }
 }
 
 SplitCoord ProjectCoord(const Image& data_source, const SplitCoord& source,
                         const SplitCoord& offset) {
+  return ProjectCoord(data_source.width, data_source.height, source, offset);
+}
+
+SplitCoord ProjectCoord(uint32 width, uint32 height, const SplitCoord& source,
+                        const SplitCoord& offset) {
   // We do not permit offsets that are greater than half the dimension
-  int32 half_width = data_source.width >> 0x1;
-  int32 half_height = data_source.height >> 0x1;
+  int32 half_width = width >> 0x1;
+  int32 half_height = height >> 0x1;
 
   int32 offset_x = clip_range(offset.x, -half_width, half_width);
   int32 offset_y = clip_range(offset.y, -half_height, half_height);
@@ -36,38 +42,88 @@ SplitCoord ProjectCoord(const Image& data_source, const SplitCoord& source,
   if (result.x < 0) result.x = -1 * result.x;
   if (result.y < 0) result.y = -1 * result.y;
 
-  if (result.x >= data_source.width - 1) {
-    result.x = ((data_source.width - 1) << 0x1) - result.x;
+  if (result.x >= width - 1) {
+    result.x = ((width - 1) << 0x1) - result.x;
   }
 
-  if (result.y >= data_source.height - 1) {
-    result.y = ((data_source.height - 1) << 0x1) - result.y;
+  if (result.y >= height - 1) {
+    result.y = ((height - 1) << 0x1) - result.y;
   }
 
   return result;
 }
 
+int32 GetPaddedOffset(uint32 width, uint32 height, uint32 row_stride,
+                      const SplitCoord& offset) {
+  int32 half_width = width >> 0x1;
+  int32 half_height = height >> 0x1;
+
+  int32 offset_x = clip_range(offset.x, -half_width, half_width);
+  int32 offset_y = clip_range(offset.y, -half_height, half_height);
+
+  return offset_y * static_cast<int32>(row_stride) + offset_x;
+}
+
+void SplitFunction::GetProbeOffsets(SplitCoord* offset0,
+                                    SplitCoord* offset1) const {
+  SplitCoord zero_offset = {0, 0};
+  *offset0 = params_.size() ? params_.at(0) : zero_offset;
+  *offset1 = (2 == params_.size()) ? params_.at(1) : zero_offset;
+}
+
+void SplitFunction::GetPaddedProbeOffsets(uint32 width, uint32 height,
+                                          uint32 row_stride, int32* offset0,
+                                          int32* offset1) const {
+  SplitCoord probe_offset0, probe_offset1;
+  GetProbeOffsets(&probe_offset0, &probe_offset1);
+  *offset0 = GetPaddedOffset(width, height, row_stride, probe_offset0);
+  *offset1 = GetPaddedOffset(width, height, row_stride, probe_offset1);
+}
+
 bool SplitFunction::Split(const SplitCoord& coord, Image* data_source) {
+  if (data_source->data.empty()) {
+    return false;
+  }
+
+  return Split(coord, data_source->data.data(), data_source->width,
+               data_source->height, data_source->width);
+}
+
+bool SplitFunction::Split(const SplitCoord& coord, const uint8* data,
+                          uint32 width, uint32 height,
+                          uint32 row_stride) const {
   if (!params_.size()) {
     return false;
   }
 
   if (2 == params_.size()) {
-    SplitCoord param_coord0 = ProjectCoord(*data_source, coord, params_.at(0));
-    SplitCoord param_coord1 = ProjectCoord(*data_source, coord, params_.at(1));
-    int32 value0 = data_source->GetPixel(param_coord0.x, param_coord0.y);
-    int32 value1 = data_source->GetPixel(param_coord1.x, param_coord1.y);
+    SplitCoord param_coord0 = ProjectCoord(width, height, coord, params_.at(0));
+    SplitCoord param_coord1 = ProjectCoord(width, height, coord, params_.at(1));
+    int32 value0 = data[param_coord0.y * row_stride + param_coord0.x];
+    int32 value1 = data[param_coord1.y * row_stride + param_coord1.x];
 
-    return value1 > value0;
+    return value1 - value0 > threshold_;
   } else if (1 == params_.size()) {
-    SplitCoord param_coord0 = ProjectCoord(*data_source, coord, params_.at(0));
-    int32 value0 = data_source->GetPixel(param_coord0.x, param_coord0.y);
-    int32 source = data_source->GetPixel(coord.x, coord.y);
+    SplitCoord param_coord0 = ProjectCoord(width, height, coord, params_.at(0));
+    int32 value0 = data[param_coord0.y * row_stride + param_coord0.x];
+    int32 source = data[coord.y * row_stride + coord.x];
 
-    return source > value0;
+    return source - value0 > threshold_;
   }
 
   return false;
 }
 
+bool SplitFunction::SplitPadded(const uint8* sample, uint32 width,
+                                uint32 height, uint32 row_stride) const {
+  if (!params_.size()) {
+    return false;
+  }
+
+  int32 offset0, offset1;
+  GetPaddedProbeOffsets(width, height, row_stride, &offset0, &offset1);
+
+  return int32(sample[offset1]) - sample[offset0] > threshold_;
+}
+
 }  // namespace base
\ No newline at end of file
@@ -37,6 +37,7 @@
 
 #include "base_types.h"
 #include "image.h"
+#include "random.h"
 
 using ::std::ifstream;
 using ::std::ofstream;
@@ -51,23 +52,67 @@ typedef struct SplitCoord {
   int32 y;
 } SplitCoord;
 
+// Offsets source within data_source, reflecting coordinates that fall
+// outside of the image back into it.
+SplitCoord ProjectCoord(const Image& data_source, const SplitCoord& source,
+                        const SplitCoord& offset);
+SplitCoord ProjectCoord(uint32 width, uint32 height, const SplitCoord& source,
+                        const SplitCoord& offset);
+
+// Returns the byte offset of a probe within an image of the specified
+// dimensions that carries a mirrored border. Offsets are limited to half
+// of each dimension, exactly as they are by ProjectCoord.
+int32 GetPaddedOffset(uint32 width, uint32 height, uint32 row_stride,
+                      const SplitCoord& offset);
+
+// Split functions compare the difference between two probe pixels, which
+// lies within [-kMaxSplitDifference, kMaxSplitDifference], to a threshold.
+const int32 kMaxSplitDifference = 255;
+// The number of distinct probe differences.
+const uint32 kSplitDifferenceBinCount = 2 * kMaxSplitDifference + 1;
+
 // Our split function (aka weak learner) that is selected out of a
 // pool of randomly generated functions.
 class SplitFunction {
  public:
-  // Initializes the object with random parameters bounded by the radius.
-  void Initialize(int32 max_search_radius);
+  // Initializes the object with random parameters bounded by the radius,
+  // and a threshold of zero.
+  void Initialize(int32 max_search_radius, RandomGenerator* random);
+  // Sets the threshold that the probe difference must exceed for a sample
+  // to go right.
+  void SetThreshold(int32 threshold) { threshold_ = threshold; }
+  int32 GetThreshold() const { return threshold_; }
   // Sorts the sample based on internal parameters.
   bool Split(const SplitCoord& coord, Image* data_source);
+  // Sorts a sample within a row-major image of the specified dimensions,
+  // whose rows are row_stride bytes apart.
+  bool Split(const SplitCoord& coord, const uint8* data, uint32 width,
+             uint32 height, uint32 row_stride) const;
+  // Sorts the sample that sample points to, within an image of the
+  // specified dimensions that carries a mirrored border (see Dataset) wide
+  // enough for our offsets. Probes are direct loads that never need to be
+  // projected back into the image.
+  bool SplitPadded(const uint8* sample, uint32 width, uint32 height,
+                   uint32 row_stride) const;
+  // Retrieves the two probe offsets compared by Split (value at offset1 -
+  // value at offset0 > threshold goes right). Single offset functions
+  // compare against the sample itself, which is reported as a zero offset1.
+  void GetProbeOffsets(SplitCoord* offset0, SplitCoord* offset1) const;
+  // Retrieves the probe offsets as they apply to an image of the specified
+  // dimensions (see ProjectCoord), in bytes relative to the sample.
+  void GetPaddedProbeOffsets(uint32 width, uint32 height, uint32 row_stride,
+                             int32* offset0, int32* offset1) const;
 
  private:
   // The 2D offset parameters that define the behavior of this split.
   vector<SplitCoord> params_;
+  // Samples whose probe difference exceeds this go right.
+  int32 threshold_ = 0;
   // Provide access for our serialization API.
   friend bool SaveSplitFunction(ofstream* out_stream,
                                 const SplitFunction& input, string* error);
   friend bool LoadSplitFunction(ifstream* in_stream, SplitFunction* output,
-                                string* error);
+                                uint32 version, string* error);
 };
 
 }  // namespace base
@@ -3,6 +3,43 @@
 
 namespace base {
 
+// The size of our params structures prior to versioning. Version 0 files
+// store these without size prefixes.
+const uint32 kVersion0ForestParamsSize = 2 * sizeof(uint32);
+const uint32 kVersion0TreeParamsSize = 5 * sizeof(uint32);
+
+// Params structures are written with a size prefix so that fields may be
+// appended to them without invalidating older files.
+bool SaveParams(ofstream *out_stream, const void *input, uint32 size) {
+  return out_stream->write((char *)&size, sizeof(uint32)) &&
+         out_stream->write((char *)input, size);
+}
+
+// Loads params saved by SaveParams (or a version 0 params structure of
+// version0_size bytes). Fields missing from the file are zeroed, and fields
+// unknown to us are skipped.
+bool LoadParams(ifstream *in_stream, void *output, uint32 size,
+                uint32 version0_size, uint32 version) {
+  uint32 stored_size = version0_size;
+
+  if (version && !in_stream->read((char *)&stored_size, sizeof(uint32))) {
+    return false;
+  }
+
+  memset(output, 0, size);
+
+  if (!in_stream->read((char *)output,
+                       (stored_size < size) ? stored_size : size)) {
+    return false;
+  }
+
+  if (stored_size > size) {
+    return !!in_stream->seekg(stored_size - size, ::std::ios::cur);
+  }
+
+  return true;
+}
+
 bool SaveSplitFunction(ofstream *out_stream, const SplitFunction &input,
                        string *error) {
   uint32 param_count = input.params_.size();
@@ -23,11 +60,18 @@ bool SaveSplitFunction(ofstream *out_stream, const SplitFunction &input,
     }
   }
 
+  if (!out_stream->write((char *)&input.threshold_, sizeof(int32))) {
+    if (error) {
+      *error = "Failed to write split threshold to disk.";
+    }
+    return false;
+  }
+
   return true;
 }
 
 bool LoadSplitFunction(ifstream *in_stream, SplitFunction *output,
-                       string *error) {
+                       uint32 version, string *error) {
   uint32 param_count = 0;
   if (!in_stream->read((char *)&param_count, sizeof(uint32))) {
     if (error) {
@@ -47,19 +91,31 @@ bool LoadSplitFunction(ifstream *in_stream, SplitFunction *output,
     }
   }
 
+  // Versions prior to 2 always split at a threshold of zero.
+  output->threshold_ = 0;
+
+  if (version >= 2 &&
+      !in_stream->read((char *)&output->threshold_, sizeof(int32))) {
+    if (error) {
+      *error = "Failed to read split threshold from disk.";
+    }
+    return false;
+  }
+
   return true;
 }
 
 bool SaveHistogram(ofstream *out_stream, const Histogram &input,
                    string *error) {
-  if (!out_stream->write((char *)&input.sample_total_, sizeof(uint64))) {
+  uint64 sample_total = input.GetSampleTotal();
+  if (!out_stream->write((char *)&sample_total, sizeof(uint64))) {
     if (error) {
       *error = "Failed to write histogram total sample count to disk.";
     }
     return false;
   }
 
-  uint32 class_count = input.class_totals_.size();
+  uint32 class_count = input.GetClassCount();
   if (!out_stream->write((char *)&class_count, sizeof(uint32))) {
     if (error) {
       *error = "Failed to write histogram class count to disk.";
@@ -67,7 +123,8 @@ bool SaveHistogram(ofstream *out_stream, const Histogram &input,
     return false;
   }
 
-  for (auto value : input.class_totals_) {
+  for (uint32 i = 0; i < class_count; i++) {
+    uint32 value = input.GetClassTotal(i);
     if (!out_stream->write((char *)&value, sizeof(uint32))) {
       if (error) {
         *error = "Failed to write histogram sample to disk.";
@@ -80,7 +137,9 @@ bool SaveHistogram(ofstream *out_stream, const Histogram &input,
 }
 
 bool LoadHistogram(ifstream *in_stream, Histogram *output, string *error) {
-  if (!in_stream->read((char *)&output->sample_total_, sizeof(uint64))) {
+  // The sample total is rebuilt from the class totals as they are read.
+  uint64 sample_total = 0;
+  if (!in_stream->read((char *)&sample_total, sizeof(uint64))) {
     if (error) {
       *error = "Failed to read histogram total sample count from disk.";
     }
@@ -95,14 +154,23 @@ bool LoadHistogram(ifstream *in_stream, Histogram *output, string *error) {
     return false;
   }
 
-  output->class_totals_.resize(class_count);
-  for (auto &value : output->class_totals_) {
+  if (class_count > kMaxClassCount) {
+    if (error) {
+      *error = "Invalid histogram class count detected.";
+    }
+    return false;
+  }
+
+  output->Initialize(class_count);
+  for (uint32 i = 0; i < class_count; i++) {
+    uint32 value = 0;
     if (!in_stream->read((char *)&value, sizeof(uint32))) {
       if (error) {
         *error = "Failed to read histogram sample from disk.";
       }
       return false;
     }
+    output->IncrementValue(i, value);
   }
 
   return true;
@@ -111,7 +179,7 @@ bool LoadHistogram(ifstream *in_stream, Histogram *output, string *error) {
 bool SaveDecisionTree(ofstream *out_stream, DecisionTree *input,
                       string *error) {
   // First is our DecisionTreeParams structure
-  if (!out_stream->write((char *)&input->params_, sizeof(DecisionTreeParams))) {
+  if (!SaveParams(out_stream, &input->params_, sizeof(DecisionTreeParams))) {
     if (error) {
       *error = "Failed to write decision tree params to disk.";
     }
@@ -154,9 +222,10 @@ bool SaveDecisionTree(ofstream *out_stream, DecisionTree *input,
 }
 
 bool LoadDecisionTree(ifstream *in_stream, DecisionTree *output,
-                      string *error) {
+                      uint32 version, string *error) {
   // First is our DecisionTreeParams structure
-  if (!in_stream->read((char *)&output->params_, sizeof(DecisionTreeParams))) {
+  if (!LoadParams(in_stream, &output->params_, sizeof(DecisionTreeParams),
+                  kVersion0TreeParamsSize, version)) {
     if (error) {
       *error = "Failed to read decision tree params from disk.";
     }
@@ -191,7 +260,7 @@ bool LoadDecisionTree(ifstream *in_stream, DecisionTree *output,
       tree_stack.push_back(node->left_child_.get());
       tree_stack.push_back(node->right_child_.get());
 
-      if (!LoadSplitFunction(in_stream, &node->function_, error)) {
+      if (!LoadSplitFunction(in_stream, &node->function_, version, error)) {
         return false;
       }
     } else {
@@ -211,16 +280,24 @@ bool SaveDecisionForest(const string &filename, DecisionForest *input,
                         string *error) {
   ofstream out_stream(filename, ::std::ios::out | ::std::ios::binary);
 
-  if (!out_stream.write((char *)&input->forest_params_,
-                        sizeof(DecisionForestParams))) {
+  if (!out_stream.write((char *)&kForestFileMagic, sizeof(uint32)) ||
+      !out_stream.write((char *)&kForestFileVersion, sizeof(uint32))) {
+    if (error) {
+      *error = "Failed to write decision forest header to disk.";
+    }
+    return false;
+  }
+
+  if (!SaveParams(&out_stream, &input->forest_params_,
+                  sizeof(DecisionForestParams))) {
     if (error) {
       *error = "Failed to write decision forest params to disk.";
     }
     return false;
   }
 
-  if (!out_stream.write((char *)&input->tree_params_,
-                        sizeof(DecisionTreeParams))) {
+  if (!SaveParams(&out_stream, &input->tree_params_,
+                  sizeof(DecisionTreeParams))) {
     if (error) {
       *error = "Failed to write decision tree params to disk.";
     }
@@ -239,27 +316,402 @@ bool SaveDecisionForest(const string &filename, DecisionForest *input,
 bool LoadDecisionForest(const string &filename, DecisionForest *output,
                         string *error) {
   ifstream in_stream(filename, ::std::ios::in | ::std::ios::binary);
+  uint32 magic = 0;
+  uint32 version = 0;
+
+  if (!in_stream.read((char *)&magic, sizeof(uint32))) {
+    if (error) {
+      *error = "Failed to read decision forest header from disk.";
+    }
+    return false;
+  }
+
+  // Unversioned files begin directly with the forest params.
+  if (kForestFileMagic != magic) {
+    in_stream.seekg(0, ::std::ios::beg);
+  } else if (!in_stream.read((char *)&version, sizeof(uint32)) ||
+             version > kForestFileVersion) {
+    if (error) {
+      *error = "Unsupported decision forest file version.";
+    }
+    return false;
+  }
 
-  if (!in_stream.read((char *)&output->forest_params_,
-                      sizeof(DecisionForestParams))) {
+  if (!LoadParams(&in_stream, &output->forest_params_,
+                  sizeof(DecisionForestParams), kVersion0ForestParamsSize,
+                  version)) {
     if (error) {
       *error = "Failed to read decision forest params from disk.";
     }
     return false;
   }
 
-  if (!in_stream.read((char *)&output->tree_params_,
-                      sizeof(DecisionTreeParams))) {
+  if (!LoadParams(&in_stream, &output->tree_params_,
+                  sizeof(DecisionTreeParams), kVersion0TreeParamsSize,
+                  version)) {
     if (error) {
       *error = "Failed to read decision tree params from disk.";
     }
     return false;
   }
 
-  output->decision_forest_.resize(output->forest_params_.total_tree_count);
+  // Shards hold only a subset of the trees of their forest.
+  uint32 tree_count = output->forest_params_.shard_tree_count
+                          ? output->forest_params_.shard_tree_count
+                          : output->forest_params_.total_tree_count;
+
+  output->decision_forest_.clear();
+  output->decision_forest_.resize(tree_count);
+  output->compiled_forest_.Clear();
 
   for (auto &i : output->decision_forest_) {
-    if (!LoadDecisionTree(&in_stream, &i, error)) {
+    if (!LoadDecisionTree(&in_stream, &i, version, error)) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+bool AppendDecisionForest(const string &filename, DecisionForest *input,
+                          string *error) {
+  if (!input || input->forest_params_.shard_tree_count) {
+    if (error) {
+      *error = "Invalid parameter(s) specified to AppendDecisionForest.";
+    }
+    return false;
+  }
+
+  ifstream in_stream(filename, ::std::ios::in | ::std::ios::binary);
+  uint32 magic = 0;
+  uint32 version = 0;
+  uint32 forest_params_size = 0;
+  uint32 tree_params_size = 0;
+  DecisionForestParams forest_params;
+  DecisionTreeParams tree_params;
+
+  // Our params are rewritten in place, so the file must store them exactly
+  // as we would.
+  if (!in_stream.read((char *)&magic, sizeof(uint32)) ||
+      !in_stream.read((char *)&version, sizeof(uint32)) ||
+      !in_stream.read((char *)&forest_params_size, sizeof(uint32)) ||
+      kForestFileMagic != magic || kForestFileVersion != version ||
+      sizeof(DecisionForestParams) != forest_params_size) {
+    if (error) {
+      *error = "Decision forest file must be saved in the current format "
+               "before trees may be appended to it.";
+    }
+    return false;
+  }
+
+  ::std::streamoff forest_params_offset = in_stream.tellg();
+
+  if (!in_stream.read((char *)&forest_params, sizeof(DecisionForestParams)) ||
+      !in_stream.read((char *)&tree_params_size, sizeof(uint32)) ||
+      !in_stream.read((char *)&tree_params, sizeof(DecisionTreeParams)) ||
+      sizeof(DecisionTreeParams) != tree_params_size) {
+    if (error) {
+      *error = "Decision forest file must be saved in the current format "
+               "before trees may be appended to it.";
+    }
+    return false;
+  }
+
+  // The file's trees must have been trained with the same data and seeds
+  // as ours, or its forest is not the one that we have grown.
+  if (forest_params.shard_tree_count ||
+      forest_params.total_tree_count > input->decision_forest_.size() ||
+      forest_params.random_seed != input->forest_params_.random_seed ||
+      forest_params.tree_training_percentage !=
+          input->forest_params_.tree_training_percentage ||
+      memcmp(&tree_params, &input->tree_params_, sizeof(DecisionTreeParams))) {
+    if (error) {
+      *error = "Decision forest file does not hold the forest's original "
+               "trees.";
+    }
+    return false;
+  }
+
+  // Any bytes that follow the file's counted trees were left by a failed
+  // append, so we find the end of those trees and write ours from there,
+  // rather than from the end of the file.
+  DecisionTree skipped_tree;
+
+  for (uint32 i = 0; i < forest_params.total_tree_count; i++) {
+    if (!LoadDecisionTree(&in_stream, &skipped_tree, version, error)) {
+      return false;
+    }
+  }
+
+  ::std::streamoff trees_end_offset = in_stream.tellg();
+  in_stream.close();
+
+  // Trees are written before the params that count them, so that a failed
+  // append leaves the file's original forest intact. Opening for input as
+  // well as output preserves the file's contents.
+  ofstream out_stream(filename, ::std::ios::in | ::std::ios::out |
+                                    ::std::ios::binary);
+
+  if (!out_stream.seekp(trees_end_offset, ::std::ios::beg)) {
+    if (error) {
+      *error = "Failed to write decision tree to disk.";
+    }
+    return false;
+  }
+
+  for (uint32 i = forest_params.total_tree_count;
+       i < input->decision_forest_.size(); i++) {
+    if (!SaveDecisionTree(&out_stream, &input->decision_forest_.at(i),
+                          error)) {
+      return false;
+    }
+  }
+
+  if (!out_stream.flush()) {
+    if (error) {
+      *error = "Failed to write decision tree to disk.";
+    }
+    return false;
+  }
+
+  if (!out_stream.seekp(forest_params_offset, ::std::ios::beg) ||
+      !out_stream.write((char *)&input->forest_params_,
+                        sizeof(DecisionForestParams)) ||
+      !out_stream.flush()) {
+    if (error) {
+      *error = "Failed to write decision forest params to disk.";
+    }
+    return false;
+  }
+
+  return true;
+}
+
+// Returns true if leaf leaf_index of a tree whose leaves begin at leaf_start
+// lies beyond a table of leaf_count leaves.
+inline bool IsLeafOutOfRange(uint32 leaf_start, uint32 leaf_index,
+                             uint32 leaf_count) {
+  return leaf_start >= leaf_count || leaf_index >= leaf_count - leaf_start;
+}
+
+// Writes the threshold and child links of each quantized node.
+template <typename Link>
+bool SaveQuantizedNodes(ofstream *out_stream,
+                        const vector<QuantizedNode<Link>> &nodes) {
+  for (auto &node : nodes) {
+    if (!out_stream->write((char *)&node.threshold, sizeof(int16)) ||
+        !out_stream->write((char *)node.child_links, 2 * sizeof(Link))) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+// Reads node_count quantized nodes written by SaveQuantizedNodes. Node
+// links must lead forward to another of our nodes.
+template <typename Link>
+bool LoadQuantizedNodes(ifstream *in_stream, uint32 node_count,
+                        vector<QuantizedNode<Link>> *nodes) {
+  const Link leaf_link_bit = Link(1) << (sizeof(Link) * 8 - 1);
+
+  nodes->resize(node_count);
+
+  for (uint32 i = 0; i < node_count; i++) {
+    QuantizedNode<Link> &node = nodes->at(i);
+
+    if (!in_stream->read((char *)&node.threshold, sizeof(int16)) ||
+        !in_stream->read((char *)node.child_links, 2 * sizeof(Link))) {
+      return false;
+    }
+
+    for (uint32 j = 0; j < 2; j++) {
+      Link link = node.child_links[j];
+
+      if (!(link & leaf_link_bit) && (!link || link >= node_count - i)) {
+        return false;
+      }
+    }
+  }
+
+  return true;
+}
+
+// Walks the tree rooted at node root_index, verifying that every leaf that
+// it reaches lies within leaf_count. The walk visits at most as many nodes
+// as we hold, so that nodes shared by many paths cannot stall it.
+template <typename Link>
+bool ValidateQuantizedTree(const vector<QuantizedNode<Link>> &nodes,
+                           uint32 root_index, uint32 leaf_start,
+                           uint32 leaf_count) {
+  const Link leaf_link_bit = Link(1) << (sizeof(Link) * 8 - 1);
+  vector<uint32> node_stack(1, root_index);
+  uint32 visit_count = 0;
+
+  while (!node_stack.empty()) {
+    uint32 node_index = node_stack.back();
+    node_stack.pop_back();
+
+    if (++visit_count > nodes.size()) {
+      return false;
+    }
+
+    for (auto link : nodes[node_index].child_links) {
+      if (!(link & leaf_link_bit)) {
+        node_stack.push_back(node_index + link);
+      } else if (IsLeafOutOfRange(leaf_start, link & ~leaf_link_bit,
+                                  leaf_count)) {
+        return false;
+      }
+    }
+  }
+
+  return true;
+}
+
+bool SaveQuantizedForest(const string &filename, QuantizedForest *input,
+                         string *error) {
+  ofstream out_stream(filename, ::std::ios::out | ::std::ios::binary);
+  uint32 link_bits = input->long_nodes_.size() ? 32 : 16;
+  uint32 tree_count = input->tree_links_.size();
+  uint32 node_count = input->probe_offsets_.size() / 4;
+  uint32 posterior_size = input->leaf_posteriors_.size();
+
+  if (!out_stream.write((char *)&kQuantizedForestFileMagic, sizeof(uint32)) ||
+      !out_stream.write((char *)&kQuantizedForestFileVersion,
+                        sizeof(uint32)) ||
+      !SaveParams(&out_stream, &input->tree_params_,
+                  sizeof(DecisionTreeParams)) ||
+      !out_stream.write((char *)&input->lane_count_, sizeof(uint32)) ||
+      !out_stream.write((char *)&input->posterior_bits_, sizeof(uint32)) ||
+      !out_stream.write((char *)&link_bits, sizeof(uint32)) ||
+      !out_stream.write((char *)&tree_count, sizeof(uint32)) ||
+      !out_stream.write((char *)&node_count, sizeof(uint32)) ||
+      !out_stream.write((char *)&posterior_size, sizeof(uint32))) {
+    if (error) {
+      *error = "Failed to write quantized forest header to disk.";
+    }
+    return false;
+  }
+
+  if (!out_stream.write((char *)input->tree_links_.data(),
+                        tree_count * sizeof(uint32)) ||
+      !out_stream.write((char *)input->tree_leaf_starts_.data(),
+                        tree_count * sizeof(uint32)) ||
+      !out_stream.write((char *)input->probe_offsets_.data(), node_count * 4) ||
+      !SaveQuantizedNodes(&out_stream, input->short_nodes_) ||
+      !SaveQuantizedNodes(&out_stream, input->long_nodes_) ||
+      !out_stream.write((char *)input->leaf_posteriors_.data(),
+                        posterior_size)) {
+    if (error) {
+      *error = "Failed to write quantized forest to disk.";
+    }
+    return false;
+  }
+
+  return true;
+}
+
+bool LoadQuantizedForest(const string &filename, QuantizedForest *output,
+                         string *error) {
+  ifstream in_stream(filename, ::std::ios::in | ::std::ios::binary);
+  uint32 magic = 0;
+  uint32 version = 0;
+  uint32 link_bits = 0;
+  uint32 tree_count = 0;
+  uint32 node_count = 0;
+  uint32 posterior_size = 0;
+
+  output->Clear();
+
+  if (!in_stream.read((char *)&magic, sizeof(uint32)) ||
+      !in_stream.read((char *)&version, sizeof(uint32)) ||
+      kQuantizedForestFileMagic != magic ||
+      kQuantizedForestFileVersion != version) {
+    if (error) {
+      *error = "Unsupported quantized forest file version.";
+    }
+    return false;
+  }
+
+  if (!LoadParams(&in_stream, &output->tree_params_,
+                  sizeof(DecisionTreeParams), kVersion0TreeParamsSize,
+                  version) ||
+      !in_stream.read((char *)&output->lane_count_, sizeof(uint32)) ||
+      !in_stream.read((char *)&output->posterior_bits_, sizeof(uint32)) ||
+      !in_stream.read((char *)&link_bits, sizeof(uint32)) ||
+      !in_stream.read((char *)&tree_count, sizeof(uint32)) ||
+      !in_stream.read((char *)&node_count, sizeof(uint32)) ||
+      !in_stream.read((char *)&posterior_size, sizeof(uint32))) {
+    if (error) {
+      *error = "Failed to read quantized forest header from disk.";
+    }
+    return false;
+  }
+
+  uint32 posterior_bytes = output->posterior_bits_ / 8;
+  uint32 leaf_size = output->lane_count_ * posterior_bytes;
+
+  if (!tree_count || !output->lane_count_ ||
+      output->lane_count_ > kMaxClassCount ||
+      output->lane_count_ % kHistogramLaneCount ||
+      (8 != output->posterior_bits_ && 16 != output->posterior_bits_) ||
+      (16 != link_bits && 32 != link_bits) || posterior_size % leaf_size) {
+    if (error) {
+      *error = "Invalid quantized forest header detected.";
+    }
+    output->Clear();
+    return false;
+  }
+
+  uint32 leaf_count = posterior_size / leaf_size;
+
+  output->tree_links_.resize(tree_count);
+  output->tree_leaf_starts_.resize(tree_count);
+  output->probe_offsets_.resize(node_count * 4);
+  output->leaf_posteriors_.resize(posterior_size);
+
+  if (!in_stream.read((char *)output->tree_links_.data(),
+                      tree_count * sizeof(uint32)) ||
+      !in_stream.read((char *)output->tree_leaf_starts_.data(),
+                      tree_count * sizeof(uint32)) ||
+      !in_stream.read((char *)output->probe_offsets_.data(), node_count * 4) ||
+      !(16 == link_bits
+            ? LoadQuantizedNodes(&in_stream, node_count, &output->short_nodes_)
+            : LoadQuantizedNodes(&in_stream, node_count,
+                                 &output->long_nodes_)) ||
+      !in_stream.read((char *)output->leaf_posteriors_.data(),
+                      posterior_size)) {
+    if (error) {
+      *error = "Failed to read quantized forest from disk.";
+    }
+    output->Clear();
+    return false;
+  }
+
+  // Leaf links are relative to their tree's first leaf, so every tree is
+  // walked to ensure that the leaves it reaches lie within our table.
+  for (uint32 i = 0; i < tree_count; i++) {
+    uint32 link = output->tree_links_[i];
+    uint32 leaf_start = output->tree_leaf_starts_[i];
+    bool is_valid = false;
+
+    if (link & kCompiledLeafLink) {
+      is_valid = !IsLeafOutOfRange(leaf_start, link & ~kCompiledLeafLink,
+                                   leaf_count);
+    } else if (link < node_count) {
+      is_valid = (16 == link_bits)
+                     ? ValidateQuantizedTree(output->short_nodes_, link,
+                                             leaf_start, leaf_count)
+                     : ValidateQuantizedTree(output->long_nodes_, link,
+                                             leaf_start, leaf_count);
+    }
+
+    if (!is_valid) {
+      if (error) {
+        *error = "Invalid quantized forest structure detected.";
+      }
+      output->Clear();
       return false;
     }
   }
@@ -36,6 +36,7 @@
 #include <string>
 #include "base_types.h"
 #include "forest.h"
+#include "quantized.h"
 #include "tree.h"
 
 using ::std::ifstream;
@@ -43,12 +44,26 @@ using ::std::ofstream;
 using ::std::string;
 
 namespace base {
+
+// Forest files begin with this magic number and a format version. Files
+// written before versioning was introduced begin directly with the forest
+// params, and are read as version 0.
+const uint32 kForestFileMagic = 0x46524452;  // "RDRF"
+//
+// Version 2 adds a threshold to each split function.
+const uint32 kForestFileVersion = 2;
+
+// Quantized forest files begin with this magic number and a format version.
+const uint32 kQuantizedForestFileMagic = 0x46514452;  // "RDQF"
+const uint32 kQuantizedForestFileVersion = 1;
+
 // Saves a split function to an established output file stream.
 bool SaveSplitFunction(ofstream* out_stream, const SplitFunction& input,
                        string* error = nullptr);
-// Loads a split function from an established input file stream.
+// Loads a split function from an established input file stream. The
+// version identifies the forest file format that it was written with.
 bool LoadSplitFunction(ifstream* in_stream, SplitFunction* output,
-                       string* error = nullptr);
+                       uint32 version, string* error = nullptr);
 // Saves a histogram to an established output file stream.
 bool SaveHistogram(ofstream* out_stream, const Histogram& input,
                    string* error = nullptr);
@@ -58,15 +73,28 @@ bool LoadHistogram(ifstream* in_stream, Histogram* output,
 // Saves a decision tree to an established output file stream.
 bool SaveDecisionTree(ofstream* out_stream, DecisionTree* input,
                       string* error = nullptr);
-// Loads a decision tree from an established input file stream.
+// Loads a decision tree from an established input file stream. The version
+// identifies the forest file format that the tree was written with.
 bool LoadDecisionTree(ifstream* in_stream, DecisionTree* output,
-                      string* error = nullptr);
+                      uint32 version, string* error = nullptr);
 // Saves a decision forest to filename.
 bool SaveDecisionForest(const string& filename, DecisionForest* input,
                         string* error = nullptr);
 // Loads a decision forest from filename.
 bool LoadDecisionForest(const string& filename, DecisionForest* output,
                         string* error = nullptr);
+// Adds the trees of a grown forest (see DecisionForest::Grow) to filename,
+// which must hold the forest's original trees in the current file format.
+// The new trees are appended and the forest params are updated in place,
+// so the trees already in the file are not rewritten.
+bool AppendDecisionForest(const string& filename, DecisionForest* input,
+                          string* error = nullptr);
+// Saves a quantized forest to filename.
+bool SaveQuantizedForest(const string& filename, QuantizedForest* input,
+                         string* error = nullptr);
+// Loads a quantized forest from filename.
+bool LoadQuantizedForest(const string& filename, QuantizedForest* output,
+                         string* error = nullptr);
 
 }  // namespace base
 
@@ -1,23 +1,479 @@
 
 #include "tree.h"
 
+#include <algorithm>
+#include <utility>
+
+#include "bank.h"
+#include "evaluator.h"
 #include "numeric.h"
+#include "random.h"
+
+using ::std::pair;
 
 namespace base {
 
-float32 ComputeInformationGain(const Histogram& parent, const Histogram& left,
-                               const Histogram& right) {
-  // Our computations use integer variables but must occur at float precision.
-  float32 parent_total = parent.GetSampleTotal();
-  return parent.GetEntropy() -
-         (((left.GetSampleTotal() / parent_total) * (left.GetEntropy())) +
-          ((right.GetSampleTotal() / parent_total) * (right.GetEntropy())));
+// Nodes with at least this many samples train their children concurrently
+// when a scheduler is available.
+const uint32 kConcurrentNodeSampleCount = 16384;
+
+// Nodes with at least this many samples evaluate their trials concurrently
+// when a scheduler is available.
+const uint32 kConcurrentTrialSampleCount = 65536;
+
+// Marks an open node in level wise training whose child is a leaf.
+const uint32 kClosedLevelNode = BASE_MAX_UINT32;
+
+// The bytes of per-sample state used by training: a sample id plus either a
+// scratch id (depth first) or an open node index (level wise).
+const uint64 kTrainingBytesPerSample = 2 * sizeof(uint32);
+
+// Bounds the memory used for trial accumulators during a level wise pass.
+// Levels with more open nodes than fit are processed in multiple passes.
+const uint64 kLevelWiseAccumulatorBudget = 256 * 1024 * 1024;
+
+// Tracks an open node during level wise training.
+typedef struct LevelWiseNode {
+  // The tree node that we're training.
+  DecisionNode* node;
+  // Impurity of the samples that reach the node.
+  float32 impurity;
+  // Candidate split functions and their accumulators. These only exist
+  // while the node's group of open nodes is being evaluated.
+  vector<SplitFunction> trial_functions;
+  vector<SplitEvaluator> evaluators;
+  // Indices of our children within the next level's open nodes, or
+  // kClosedLevelNode if the child is a leaf.
+  uint32 left_index;
+  uint32 right_index;
+} LevelWiseNode;
+
+// Returns true if a node with the specified statistics must be a leaf.
+bool IsLeafCriteriaMet(const DecisionTreeParams& params, uint32 depth,
+                       uint64 sample_count, float32 impurity) {
+  // If our incoming impurity is zero then our data set is of uniform
+  // type, and we can declare this node a leaf.
+  return depth >= params.max_tree_depth || !sample_count ||
+         sample_count < params.min_sample_count || 0.0f == impurity ||
+         -0.0f == impurity;
+}
+
+// Returns the impurity of a histogram under our split criterion.
+float32 GetImpurity(const DecisionTreeParams& params,
+                    const Histogram& histogram) {
+  if (kSplitCriterionGini == params.split_criterion) {
+    return histogram.GetGiniImpurity();
+  }
+
+  return histogram.GetEntropy();
+}
+
+float32 ComputeInformationGain(const Histogram& parent, float32 parent_entropy,
+                               const Histogram& left) {
+  // The weighted entropy of a child, (count / parent_total) * entropy, is
+  // (f(count) - sum(f(class_count))) / parent_total where f(n) = n log2(n)
+  // (see GetEntropyTerm). We accumulate both children from their integer
+  // class counts and divide once.
+  uint64 parent_total = parent.GetSampleTotal();
+  uint64 left_total = left.GetSampleTotal();
+  uint64 right_total = parent_total - left_total;
+  float64 child_impurity =
+      GetEntropyTerm(left_total) + GetEntropyTerm(right_total);
+
+  // The right histogram is never materialized. Its class totals are the
+  // parent totals minus the left totals.
+  for (uint32 i = 0; i < parent.GetClassCount(); i++) {
+    uint32 left_class_total = left.GetClassTotal(i);
+    uint32 right_class_total = parent.GetClassTotal(i) - left_class_total;
+
+    child_impurity -=
+        GetEntropyTerm(left_class_total) + GetEntropyTerm(right_class_total);
+  }
+
+  return parent_entropy - static_cast<float32>(child_impurity / parent_total);
+}
+
+float32 ComputeGiniGain(const Histogram& parent, float32 parent_impurity,
+                        const Histogram& left) {
+  // The weighted Gini impurity of a child, (count / parent_total) * (1 -
+  // sum(p^2)), is (count - sum(class_count^2) / count) / parent_total. Pure
+  // children contribute exactly zero.
+  uint64 parent_total = parent.GetSampleTotal();
+  uint64 left_total = left.GetSampleTotal();
+  uint64 right_total = parent_total - left_total;
+  float64 left_squares = 0.0;
+  float64 right_squares = 0.0;
+
+  for (uint32 i = 0; i < parent.GetClassCount(); i++) {
+    float64 left_class_total = left.GetClassTotal(i);
+    float64 right_class_total = parent.GetClassTotal(i) - left.GetClassTotal(i);
+
+    left_squares += left_class_total * left_class_total;
+    right_squares += right_class_total * right_class_total;
+  }
+
+  float64 child_impurity = 0.0;
+
+  if (left_total) {
+    child_impurity += left_total - left_squares / left_total;
+  }
+
+  if (right_total) {
+    child_impurity += right_total - right_squares / right_total;
+  }
+
+  return parent_impurity - static_cast<float32>(child_impurity / parent_total);
+}
+
+// Returns the reduction in impurity, under our split criterion, achieved
+// by splitting parent into left and (parent - left).
+float32 ComputeGain(const DecisionTreeParams& params, const Histogram& parent,
+                    float32 parent_impurity, const Histogram& left) {
+  if (kSplitCriterionGini == params.split_criterion) {
+    return ComputeGiniGain(parent, parent_impurity, left);
+  }
+
+  return ComputeInformationGain(parent, parent_impurity, left);
+}
+
+// Returns the bytes of accumulators used to evaluate a node's trials.
+uint64 GetTrialAccumulatorSize(const DecisionTreeParams& params) {
+  uint64 totals_size = params.class_count * sizeof(uint32);
+
+  if (params.learn_split_thresholds) {
+    totals_size = (params.class_count + 1) * sizeof(uint32) *
+                  uint64(kSplitDifferenceBinCount);
+  }
+
+  return params.node_trial_count *
+         (totals_size + sizeof(SplitFunction) + sizeof(SplitCoord));
+}
+
+// Scores trial k, tallied by consecutive blocks of evaluators, and returns
+// its gain along with its best threshold and the resulting left histogram.
+// When learning thresholds, we sweep the trial's difference bins in order,
+// scoring a threshold midway between each pair of adjacent non-empty bins.
+float32 ScoreTrial(const DecisionTreeParams& params, const Histogram& parent,
+                   float32 parent_impurity, const SplitEvaluator* evaluators,
+                   uint32 k, int32* threshold, Histogram* left_hist) {
+  const SplitEvaluator& evaluator = evaluators[k / kSplitBatchSize];
+  uint32 function_index = k % kSplitBatchSize;
+
+  *threshold = 0;
+
+  if (!params.learn_split_thresholds) {
+    evaluator.GetLeftHistogram(function_index, left_hist);
+    return ComputeGain(params, parent, parent_impurity, *left_hist);
+  }
+
+  Histogram bin_left_hist(params.class_count);
+  float32 best_gain = -1.0f;
+  bool found_threshold = false;
+  int32 previous_bin = -1;
+  int32 bin_count = kSplitDifferenceBinCount;
+
+  for (int32 bin = 0; bin < bin_count; bin++) {
+    if (!evaluator.GetDifferenceTotal(function_index, bin)) {
+      continue;
+    }
+
+    if (previous_bin >= 0) {
+      float32 gain =
+          ComputeGain(params, parent, parent_impurity, bin_left_hist);
+
+      if (!found_threshold || gain >= best_gain) {
+        best_gain = gain;
+        *threshold =
+            previous_bin + (bin - 1 - previous_bin) / 2 - kMaxSplitDifference;
+        *left_hist = bin_left_hist;
+        found_threshold = true;
+      }
+    }
+
+    evaluator.AddDifferenceBin(function_index, bin, &bin_left_hist);
+    previous_bin = bin;
+  }
+
+  // If every sample shares the same difference, no threshold separates
+  // them, and we send them all left.
+  if (!found_threshold) {
+    if (previous_bin >= 0) {
+      *threshold = previous_bin - kMaxSplitDifference;
+    }
+
+    *left_hist = bin_left_hist;
+    best_gain = ComputeGain(params, parent, parent_impurity, *left_hist);
+  }
+
+  return best_gain;
+}
+
+// Scans trial_count trials, tallied by consecutive blocks of evaluators, in
+// order and updates the best trial found so far. Ties go to later trials.
+// Returns true if a perfect split was found, in which case it is selected
+// and the scan stops.
+bool SelectBestTrial(const DecisionTreeParams& params, const Histogram& parent,
+                     float32 parent_impurity, const SplitFunction* functions,
+                     const SplitEvaluator* evaluators, uint32 trial_count,
+                     float32* best_info_gain, SplitFunction* best_function,
+                     Histogram* best_left_hist) {
+  Histogram trial_left_hist;
+  int32 trial_threshold = 0;
+
+  for (uint32 k = 0; k < trial_count; k++) {
+    float32 current_info_gain =
+        ScoreTrial(params, parent, parent_impurity, evaluators, k,
+                   &trial_threshold, &trial_left_hist);
+
+    if (current_info_gain >= *best_info_gain) {
+      *best_info_gain = current_info_gain;
+      *best_left_hist = trial_left_hist;
+      *best_function = functions[k];
+      best_function->SetThreshold(trial_threshold);
+
+      // If our current info gain equals impurity (i.e. both buckets have
+      // zero impurity), then we can immediately select this as our best
+      // option.
+      if (current_info_gain == parent_impurity) {
+        return true;
+      }
+    }
+  }
+
+  return false;
+}
+
+// Tallies trial_count candidate functions against sample_count samples,
+// using one evaluator per block of kSplitBatchSize candidates. Blocks are
+// evaluated concurrently if a scheduler is supplied.
+bool EvaluateTrials(const DecisionTreeParams& params, const TrainSet& train_set,
+                    const SplitFunction* functions, uint32 trial_count,
+                    const uint32* samples, uint32 sample_count,
+                    TaskScheduler* scheduler,
+                    vector<SplitEvaluator>* evaluators, string* error) {
+  uint32 block_count = align(trial_count, kSplitBatchSize) / kSplitBatchSize;
+  evaluators->resize(block_count);
+
+  for (uint32 k = 0; k < block_count; k++) {
+    uint32 block_start = k * kSplitBatchSize;
+    uint32 block_size = trial_count - block_start;
+
+    if (block_size > kSplitBatchSize) {
+      block_size = kSplitBatchSize;
+    }
+
+    evaluators->at(k).Initialize(params.class_count, &train_set,
+                                 !!params.learn_split_thresholds);
+    if (!evaluators->at(k).SetFunctions(&functions[block_start], block_size,
+                                        error)) {
+      return false;
+    }
+  }
+
+  if (scheduler && block_count > 1) {
+    TaskGroup evaluation_group;
+
+    for (auto& evaluator : *evaluators) {
+      SplitEvaluator* block_evaluator = &evaluator;
+      scheduler->Spawn(&evaluation_group, [=]() {
+        block_evaluator->AddSamples(samples, sample_count);
+      });
+    }
+
+    scheduler->Wait(&evaluation_group);
+  } else {
+    for (auto& evaluator : *evaluators) {
+      evaluator.AddSamples(samples, sample_count);
+    }
+  }
+
+  return true;
+}
+
+// Narrows functions down to a single block of finalists by successive
+// halving (see DecisionTreeParams::trial_race_sample_count). Each round
+// scores the surviving candidates on a random subset of samples, twice the
+// size of the previous round's subset, and keeps the better half. Racing
+// stops once a single block of candidates remains, or the next subset
+// would be as large as the sample set itself. Finalists retain their
+// original relative order.
+//
+// Subsets are drawn uniformly (with replacement) from samples into subset,
+// which must have room for sample_count samples.
+bool RaceTrials(const DecisionTreeParams& params, const TrainSet& train_set,
+                const uint32* samples, uint32* subset, uint32 sample_count,
+                RandomGenerator* random, TaskScheduler* scheduler,
+                vector<SplitFunction>* functions,
+                vector<SplitEvaluator>* evaluators, string* error) {
+  Histogram subset_hist(params.class_count);
+  Histogram trial_left_hist;
+  int32 trial_threshold = 0;
+  vector<pair<float32, uint32>> ranking;
+  vector<uint32> survivors;
+  uint32 subset_count = 0;
+
+  for (uint64 round_count = params.trial_race_sample_count;
+       functions->size() > kSplitBatchSize && round_count < sample_count;
+       round_count *= 2) {
+    for (; subset_count < round_count; subset_count++) {
+      uint32 sample = samples[random->Integer() % sample_count];
+      subset[subset_count] = sample;
+      subset_hist.IncrementValue(train_set.GetLabel(sample));
+    }
+
+    if (!EvaluateTrials(params, train_set, functions->data(),
+                        functions->size(), subset, subset_count, scheduler,
+                        evaluators, error)) {
+      return false;
+    }
+
+    float32 subset_impurity = GetImpurity(params, subset_hist);
+    ranking.resize(functions->size());
+
+    for (uint32 k = 0; k < functions->size(); k++) {
+      ranking[k].first =
+          ScoreTrial(params, subset_hist, subset_impurity, evaluators->data(),
+                     k, &trial_threshold, &trial_left_hist);
+      ranking[k].second = k;
+    }
+
+    // Rank by descending gain. As with SelectBestTrial, ties favor later
+    // candidates.
+    uint32 survivor_count = ::std::max<uint32>(
+        kSplitBatchSize, (functions->size() + 1) / 2);
+    ::std::nth_element(ranking.begin(), ranking.begin() + survivor_count,
+                       ranking.end(),
+                       [](const pair<float32, uint32>& lhs,
+                          const pair<float32, uint32>& rhs) {
+                         return lhs.first > rhs.first ||
+                                (lhs.first == rhs.first &&
+                                 lhs.second > rhs.second);
+                       });
+
+    survivors.resize(survivor_count);
+
+    for (uint32 k = 0; k < survivor_count; k++) {
+      survivors[k] = ranking[k].second;
+    }
+
+    ::std::sort(survivors.begin(), survivors.end());
+
+    for (uint32 k = 0; k < survivor_count; k++) {
+      functions->at(k) = functions->at(survivors[k]);
+    }
+
+    functions->resize(survivor_count);
+  }
+
+  return true;
+}
+
+// Draws a uniform random subset of params.max_split_search_samples samples
+// (without replacement) into search_samples, using reservoir sampling, and
+// tallies its labels into search_histogram. The subset is sorted so that it
+// visits our training images in memory order.
+void DrawSearchSamples(const DecisionTreeParams& params,
+                       const TrainSet& train_set, const uint32* samples,
+                       uint32 sample_count, RandomGenerator* random,
+                       vector<uint32>* search_samples,
+                       Histogram* search_histogram) {
+  uint32 search_count = params.max_split_search_samples;
+  search_samples->assign(samples, samples + search_count);
+
+  for (uint32 j = search_count; j < sample_count; j++) {
+    uint64 slot = random->Integer() % (uint64(j) + 1);
+
+    if (slot < search_count) {
+      search_samples->at(slot) = samples[j];
+    }
+  }
+
+  ::std::sort(search_samples->begin(), search_samples->end());
+  search_histogram->Initialize(params.class_count);
+
+  for (uint32 sample : *search_samples) {
+    search_histogram->IncrementValue(train_set.GetLabel(sample));
+  }
+}
+
+// Selects the best of params.node_trial_count functions drawn, without
+// replacement, from the tree's feature bank (or all of them, if the bank is
+// smaller). As with SelectBestTrial, ties go to later trials and a perfect
+// split ends the search. Large nodes count their trials concurrently if a
+// scheduler is supplied.
+void SelectBankTrial(const DecisionTreeParams& params,
+                     const TrainSet& train_set, const uint32* samples,
+                     uint32 sample_count, const Histogram& parent,
+                     float32 parent_impurity, RandomGenerator* random,
+                     TaskScheduler* scheduler, uint32* best_index,
+                     Histogram* best_left_hist) {
+  const FeatureBank* bank = train_set.feature_bank;
+  uint32 bank_size = bank->GetFunctionCount();
+  uint32 trial_count = ::std::min(params.node_trial_count, bank_size);
+  vector<uint32> trial_indices(bank_size);
+
+  for (uint32 k = 0; k < bank_size; k++) {
+    trial_indices[k] = k;
+  }
+
+  for (uint32 k = 0; k < trial_count; k++) {
+    uint32 other = k + random->Integer() % (bank_size - k);
+    ::std::swap(trial_indices[k], trial_indices[other]);
+  }
+
+  FeatureBankNode bank_node;
+  bank_node.Initialize(bank, params.class_count, samples, sample_count);
+
+  vector<Histogram> trial_left_hists(trial_count);
+  bool counted_trials = false;
+
+  if (scheduler && sample_count >= kConcurrentTrialSampleCount) {
+    TaskGroup count_group;
+
+    for (uint32 k = 0; k < trial_count; k += kSplitBatchSize) {
+      scheduler->Spawn(&count_group, [&, k]() {
+        uint32 end = ::std::min(k + kSplitBatchSize, trial_count);
+
+        for (uint32 t = k; t < end; t++) {
+          bank_node.GetLeftHistogram(trial_indices[t], &trial_left_hists[t]);
+        }
+      });
+    }
+
+    scheduler->Wait(&count_group);
+    counted_trials = true;
+  }
+
+  float32 best_gain = -1.0f;
+  *best_index = trial_indices[0];
+
+  for (uint32 k = 0; k < trial_count; k++) {
+    if (!counted_trials) {
+      bank_node.GetLeftHistogram(trial_indices[k], &trial_left_hists[k]);
+    }
+
+    float32 gain =
+        ComputeGain(params, parent, parent_impurity, trial_left_hists[k]);
+
+    if (gain >= best_gain) {
+      best_gain = gain;
+      *best_index = trial_indices[k];
+      *best_left_hist = trial_left_hists[k];
+
+      if (gain == parent_impurity) {
+        break;
+      }
+    }
+  }
 }
 
 bool DecisionNode::Train(const DecisionTreeParams& params, uint32 depth,
-                         vector<TrainSet>* samples,
-                         const Histogram& sample_histogram, string* error) {
-  if (!samples) {
+                         const TrainSet& train_set, uint32* samples,
+                         uint32* scratch, uint32 sample_count,
+                         const Histogram& sample_histogram,
+                         RandomGenerator* random, TaskScheduler* scheduler,
+                         string* error) {
+  if (!samples || !scratch || !random) {
     if (error) {
       *error = "Invalid parameter(s) specified to DecisionNode::Train.";
     }
@@ -31,77 +487,159 @@ bool DecisionNode::Train(const DecisionTreeParams& params, uint32 depth,
 
   // If we've reached our exit criteria then we early exit, leaving this
   // node as a leaf in the tree.
-  if (depth >= params.max_tree_depth || !samples->size() ||
-      samples->size() < params.min_sample_count) {
-    is_leaf_ = true;
-    return true;
-  }
-
-  float32 node_entropy = histogram_.GetEntropy();
-  // If our incoming entropy is zero then our data set is of uniform
-  // type, and we can declare this node a leaf.
-  if (0.0f == node_entropy || -0.0f == node_entropy) {
+  float32 node_impurity = GetImpurity(params, histogram_);
+  if (IsLeafCriteriaMet(params, depth, sample_count, node_impurity)) {
     is_leaf_ = true;
     return true;
   }
 
   // Perform a maximum of params.node_trial_count trials to find
   // a best candidate split function for this node. We're guaranteed
-  // to finish with a candidate, even if it's only a local best.
+  // to finish with a candidate, even if it's only a local best. Trials
+  // only tally the labels that go left; the right side is derived from
+  // our node histogram, and the samples themselves are partitioned once,
+  // after the winning split function has been selected.
+  //
+  // Trials are evaluated in blocks of kSplitBatchSize candidates, with a
+  // single pass over our samples per block. Small nodes evaluate one block
+  // at a time so that a perfect split ends the search early. Large nodes
+  // draw every trial up front and, given a scheduler, evaluate all blocks
+  // concurrently. This choice must not depend on the scheduler, or our
+  // random draws (and so the trained tree) would depend on it.
+  //
+  // Nodes with more than params.max_split_search_samples samples search
+  // for their split on a uniform random subset of that many samples (see
+  // DrawSearchSamples), while the partition and the child histograms still
+  // cover every sample.
+  //
+  // Nodes with enough samples may also race their trials (see RaceTrials),
+  // in which case only the finalists see every search sample. Our scratch
+  // buffer holds the race's sample subsets until we partition.
+  //
+  // If the tree has a feature bank, trials are instead drawn from the bank
+  // and counted against its precomputed responses (see SelectBankTrial).
+
+  const uint32* search_samples = samples;
+  uint32 search_count = sample_count;
+  const Histogram* search_histogram = &histogram_;
+  float32 search_impurity = node_impurity;
+  vector<uint32> search_subset;
+  Histogram search_subset_hist;
 
+  if (params.max_split_search_samples &&
+      sample_count > params.max_split_search_samples) {
+    DrawSearchSamples(params, train_set, samples, sample_count, random,
+                      &search_subset, &search_subset_hist);
+    search_samples = search_subset.data();
+    search_count = search_subset.size();
+    search_histogram = &search_subset_hist;
+    search_impurity = GetImpurity(params, search_subset_hist);
+  }
+
+  bool race_trials = params.trial_race_sample_count &&
+                     search_count > params.trial_race_sample_count &&
+                     params.node_trial_count > kSplitBatchSize;
+  bool draw_all_trials =
+      race_trials || search_count >= kConcurrentTrialSampleCount;
+  uint32 round_size =
+      draw_all_trials ? params.node_trial_count : kSplitBatchSize;
   float32 best_info_gain = -1.0f;
-  Histogram best_left_hist, best_right_hist;
-  vector<TrainSet> best_left_samples, best_right_samples;
-  SplitFunction best_split_function, trial_split_function;
-
-  for (uint32 i = 0; i < params.node_trial_count; i++) {
-    Histogram trial_left_hist, trial_right_hist;
-    vector<TrainSet> trial_left_samples, trial_right_samples;
-
-    trial_left_hist.Initialize(params.class_count);
-    trial_right_hist.Initialize(params.class_count);
-    trial_left_samples.reserve(samples->size());
-    trial_right_samples.reserve(samples->size());
-    trial_split_function.Initialize(params.visual_search_radius);
-
-    // Iterate over all samples, performing split. True goes right.
-    for (uint32 j = 0; j < samples->size(); j++) {
-      SplitCoord current_coord = samples->at(j).coord;
-      uint8 sample_label = samples->at(j).data_source->label.GetPixel(
-          current_coord.x, current_coord.y);
-      if (trial_split_function.Split(current_coord,
-                                     &samples->at(j).data_source->image)) {
-        trial_right_samples.push_back(samples->at(j));
-        trial_right_hist.IncrementValue(sample_label);
-      } else {
-        trial_left_samples.push_back(samples->at(j));
-        trial_left_hist.IncrementValue(sample_label);
+  bool found_perfect_split = false;
+  Histogram best_left_hist;
+  SplitFunction best_split_function;
+  vector<SplitFunction> trial_functions;
+  vector<SplitEvaluator> evaluators;
+  uint32 bank_function_index = 0;
+
+  if (train_set.feature_bank) {
+    SelectBankTrial(params, train_set, search_samples, search_count,
+                    *search_histogram, search_impurity, random, scheduler,
+                    &bank_function_index, &best_left_hist);
+    best_split_function =
+        train_set.feature_bank->GetFunction(bank_function_index);
+  } else {
+    for (uint32 i = 0; i < params.node_trial_count && !found_perfect_split;
+         i += round_size) {
+      uint32 trial_count = params.node_trial_count - i;
+
+      if (trial_count > round_size) {
+        trial_count = round_size;
       }
-    }
 
-    float32 current_info_gain =
-        ComputeInformationGain(histogram_, trial_left_hist, trial_right_hist);
-
-    if (current_info_gain >= best_info_gain) {
-      best_info_gain = current_info_gain;
-      best_left_hist = trial_left_hist;
-      best_right_hist = trial_right_hist;
-      best_left_samples = std::move(trial_left_samples);
-      best_right_samples = std::move(trial_right_samples);
-      best_split_function = trial_split_function;
-
-      // If our current info gain equals entropy (i.e. both buckets have zero
-      // entropy), then we can immediately select this as our best option.
-      if (current_info_gain == node_entropy) {
-        break;
+      trial_functions.resize(trial_count);
+
+      for (auto& function : trial_functions) {
+        function.Initialize(params.visual_search_radius, random);
       }
+
+      if (race_trials) {
+        if (!RaceTrials(params, train_set, search_samples, scratch,
+                        search_count, random, scheduler, &trial_functions,
+                        &evaluators, error)) {
+          return false;
+        }
+
+        trial_count = trial_functions.size();
+      }
+
+      if (!EvaluateTrials(params, train_set, trial_functions.data(),
+                          trial_count, search_samples, search_count,
+                          scheduler, &evaluators, error)) {
+        return false;
+      }
+
+      found_perfect_split = SelectBestTrial(
+          params, *search_histogram, search_impurity, trial_functions.data(),
+          evaluators.data(), trial_count, &best_info_gain,
+          &best_split_function, &best_left_hist);
     }
   }
 
+  // Release our trial accumulators and search subset before training our
+  // children.
+  vector<SplitFunction>().swap(trial_functions);
+  vector<SplitEvaluator>().swap(evaluators);
+  vector<uint32>().swap(search_subset);
+
   // Bind the best split function that we found during our trials.
   function_ = best_split_function;
   is_leaf_ = false;
 
+  // Partition our samples into scratch. Left samples occupy the front of
+  // the range and right samples are written back to front, after which we
+  // restore their relative order. If we searched a subset of our samples,
+  // the left histogram of our split is tallied here over all of them.
+  bool count_left_labels = (search_samples != samples);
+  uint32 left_count = 0;
+  uint32 right_count = 0;
+
+  if (count_left_labels) {
+    best_left_hist.Initialize(params.class_count);
+  }
+
+  for (uint32 j = 0; j < sample_count; j++) {
+    bool goes_right =
+        train_set.feature_bank
+            ? train_set.feature_bank->GetResponse(bank_function_index,
+                                                  samples[j])
+            : train_set.Split(function_, samples[j]);
+
+    if (goes_right) {
+      scratch[sample_count - ++right_count] = samples[j];
+    } else {
+      scratch[left_count++] = samples[j];
+
+      if (count_left_labels) {
+        best_left_hist.IncrementValue(train_set.GetLabel(samples[j]));
+      }
+    }
+  }
+
+  ::std::reverse(scratch + left_count, scratch + sample_count);
+
+  Histogram best_right_hist = histogram_;
+  best_right_hist -= best_left_hist;
+
   // We have our best so we allocate children and attempt to train them.
   left_child_.reset(new DecisionNode);
   right_child_.reset(new DecisionNode);
@@ -113,10 +651,50 @@ bool DecisionNode::Train(const DecisionTreeParams& params, uint32 depth,
     return false;
   }
 
-  if (!left_child_->Train(params, depth + 1, &best_left_samples, best_left_hist,
+  // Each child draws from its own generator, seeded from ours, so that
+  // subtrees may be trained in any order or concurrently.
+  RandomGenerator left_random(random->Integer());
+  RandomGenerator right_random(random->Integer());
+
+  // Our children swap buffers: the partitioned scratch range becomes their
+  // sample set, and our (now stale) sample range becomes their scratch.
+  // Large subtrees train our left child as a task that idle workers may
+  // steal, while we train the right child ourselves.
+  if (scheduler && sample_count >= kConcurrentNodeSampleCount) {
+    TaskGroup child_group;
+    DecisionNode* left_child = left_child_.get();
+    bool left_result = false;
+    string left_error;
+
+    scheduler->Spawn(&child_group, [&, left_child]() {
+      left_result = left_child->Train(params, depth + 1, train_set, scratch,
+                                      samples, left_count, best_left_hist,
+                                      &left_random, scheduler, &left_error);
+    });
+
+    bool right_result = right_child_->Train(
+        params, depth + 1, train_set, scratch + left_count,
+        samples + left_count, right_count, best_right_hist, &right_random,
+        scheduler, error);
+
+    scheduler->Wait(&child_group);
+
+    if (!left_result) {
+      if (error) {
+        *error = left_error;
+      }
+      return false;
+    }
+
+    return right_result;
+  }
+
+  if (!left_child_->Train(params, depth + 1, train_set, scratch, samples,
+                          left_count, best_left_hist, &left_random, scheduler,
                           error) ||
-      !right_child_->Train(params, depth + 1, &best_right_samples,
-                           best_right_hist, error)) {
+      !right_child_->Train(params, depth + 1, train_set, scratch + left_count,
+                           samples + left_count, right_count,
+                           best_right_hist, &right_random, scheduler, error)) {
     return false;
   }
 
@@ -151,10 +729,12 @@ bool DecisionNode::Classify(const SplitCoord& coord, Image* data_source,
 }
 
 bool DecisionTree::Train(const DecisionTreeParams& params,
-                         vector<ImageSet>* training_data,
+                         const Dataset* training_data,
                          uint32 training_start_index, uint32 training_count,
+                         uint64 random_seed, TaskScheduler* scheduler,
                          string* error) {
-  if (training_data->empty() || training_count > training_data->size()) {
+  if (!training_data || !training_data->GetImageCount() ||
+      training_count > training_data->GetImageCount()) {
     if (error) {
       *error = "Invalid parameter specified to DecisionTree::Train.";
     }
@@ -162,30 +742,133 @@ bool DecisionTree::Train(const DecisionTreeParams& params,
   }
 
   Histogram initial_histogram(params.class_count);
-  vector<TrainSet> tree_training_set;
+  vector<uint32> tree_training_set;
+  TrainSet train_set;
 
   // Cache a copy of our tree params for later use during classification.
   params_ = params;
 
+  // Samples are identified by compact 32 bit ids, which requires that the
+  // image index and pixel offset fit within 32 bits.
+  train_set.data = training_data;
+  train_set.width = training_data->GetWidth();
+  train_set.height = training_data->GetHeight();
+  train_set.row_stride = training_data->GetRowStride();
+  train_set.pixel_bits = 0;
+  train_set.is_padded =
+      training_data->IsBorderSufficient(params.visual_search_radius);
+  train_set.feature_bank = nullptr;
+
+  while ((1ULL << train_set.pixel_bits) <
+         uint64(train_set.width) * train_set.height) {
+    train_set.pixel_bits++;
+  }
+
+  if (train_set.pixel_bits >= 32 ||
+      training_data->GetImageCount() > (1ULL << (32 - train_set.pixel_bits))) {
+    if (error) {
+      *error = "Training data is too large to index with 32 bit samples.";
+    }
+    return false;
+  }
+
+  // Our images are read in order below, and then repeatedly during
+  // training. If they're mapped from disk, start reading them now.
+  training_data->PrefetchImages(training_start_index, training_count);
+
   // This is one of the most expensive operations in our system, so we
   // estimate the required size and reserve memory for it.
-  uint64 required_size = training_count * training_data->at(0).image.width *
-                         training_data->at(0).image.height;
+  uint64 required_size =
+      uint64(training_count) * train_set.width * train_set.height;
   tree_training_set.reserve(required_size);
 
   for (uint32 i = 0; i < training_count; i++) {
-    uint32 index = (training_start_index + i) % training_data->size();
-    uint32 width = training_data->at(index).image.width;
-    uint32 height = training_data->at(index).image.height;
-
-    for (uint32 y = 0; y < height; y++)
-      for (uint32 x = 0; x < width; x++) {
-        uint8 label_value = training_data->at(index).label.GetPixel(x, y);
-        tree_training_set.emplace_back(&training_data->at(index), x, y);
+    uint32 index = (training_start_index + i) % training_data->GetImageCount();
+
+    for (uint32 y = 0; y < train_set.height; y++)
+      for (uint32 x = 0; x < train_set.width; x++) {
+        uint8 label_value = training_data->GetLabel(index, x, y);
+        tree_training_set.push_back(train_set.GetSampleId(index, x, y));
         initial_histogram.IncrementValue(label_value);
       }
   }
 
+  RandomGenerator random(random_seed);
+
+  if (kTreeGrowthLevelWise == params.tree_growth_mode) {
+    return TrainLevelWise(params, train_set, tree_training_set,
+                          initial_histogram, &random, error);
+  }
+
+  // Precompute the responses of every sample to our feature bank, which
+  // node training then selects its split functions from.
+  FeatureBank feature_bank;
+
+  if (params.feature_bank_size) {
+    if (!feature_bank.Initialize(params, train_set, training_start_index,
+                                 training_count, &random, scheduler, error)) {
+      return false;
+    }
+
+    train_set.feature_bank = &feature_bank;
+  }
+
+  // Node training partitions samples back and forth between our training
+  // set and this equally sized scratch buffer (see DecisionNode::Train).
+  vector<uint32> tree_scratch_set(tree_training_set.size());
+
+  root_node_.reset(new DecisionNode);
+
+  if (!root_node_) {
+    if (error) {
+      *error = "Failed allocation of decision tree root node.";
+    }
+    return false;
+  }
+
+  return root_node_->Train(params, 0, train_set, tree_training_set.data(),
+                           tree_scratch_set.data(), tree_training_set.size(),
+                           initial_histogram, &random, scheduler, error);
+}
+
+uint64 DecisionTree::EstimateTrainingMemory(const DecisionTreeParams& params,
+                                            uint64 sample_count) {
+  uint64 sample_size = sample_count * kTrainingBytesPerSample;
+
+  if (kTreeGrowthLevelWise == params.tree_growth_mode) {
+    return sample_size + kLevelWiseAccumulatorBudget;
+  }
+
+  // Depth first nodes release their trials and split search subset before
+  // their children train, so each thread that trains the tree holds one
+  // node's trials (and subset) at a time.
+  uint64 trial_size = GetTrialAccumulatorSize(params);
+  uint64 search_size = 0;
+
+  if (params.max_split_search_samples) {
+    search_size = ::std::min<uint64>(sample_count,
+                                     params.max_split_search_samples) *
+                  sizeof(uint32);
+  }
+
+  if (params.feature_bank_size) {
+    search_size += FeatureBank::EstimateMemory(params, sample_count);
+  }
+
+  return sample_size + trial_size + search_size;
+}
+
+bool DecisionTree::TrainLevelWise(const DecisionTreeParams& params,
+                                  const TrainSet& train_set,
+                                  const vector<uint32>& samples,
+                                  const Histogram& sample_histogram,
+                                  RandomGenerator* random, string* error) {
+  // Our open nodes for the current and previous depth. Each sample tracks
+  // the index of the open node it belongs to. Samples are routed from the
+  // previous depth to the current one during the first pass of each depth.
+  vector<LevelWiseNode> level_nodes, parent_level_nodes;
+  vector<uint32> sample_nodes(samples.size(), 0);
+
   root_node_.reset(new DecisionNode);
 
   if (!root_node_) {
@@ -195,7 +878,155 @@ bool DecisionTree::Train(const DecisionTreeParams& params,
     return false;
   }
 
-  return root_node_->Train(params, 0, &tree_training_set, initial_histogram);
+  root_node_->histogram_ = sample_histogram;
+  root_node_->is_leaf_ = true;
+
+  float32 root_impurity = GetImpurity(params, sample_histogram);
+  if (!IsLeafCriteriaMet(params, 0, samples.size(), root_impurity)) {
+    level_nodes.resize(1);
+    level_nodes.at(0).node = root_node_.get();
+    level_nodes.at(0).impurity = root_impurity;
+  }
+
+  uint32 block_count =
+      align(params.node_trial_count, kSplitBatchSize) / kSplitBatchSize;
+  uint64 node_accumulator_size = GetTrialAccumulatorSize(params);
+
+  for (uint32 depth = 0; !level_nodes.empty(); depth++) {
+    vector<LevelWiseNode> next_level_nodes;
+    uint32 group_start = 0;
+
+    while (group_start < level_nodes.size()) {
+      // Gather a group of open nodes whose accumulators fit within our
+      // budget, and draw their candidate split functions.
+      uint32 group_end = group_start;
+      uint64 group_size = 0;
+
+      while (group_end < level_nodes.size() &&
+             (group_end == group_start ||
+              group_size + node_accumulator_size <=
+                  kLevelWiseAccumulatorBudget)) {
+        LevelWiseNode* level_node = &level_nodes.at(group_end);
+        level_node->trial_functions.resize(params.node_trial_count);
+        level_node->evaluators.resize(block_count);
+
+        for (auto& function : level_node->trial_functions) {
+          function.Initialize(params.visual_search_radius, random);
+        }
+
+        for (uint32 i = 0; i < block_count; i++) {
+          uint32 trial_start = i * kSplitBatchSize;
+          uint32 trial_count = params.node_trial_count - trial_start;
+
+          if (trial_count > kSplitBatchSize) {
+            trial_count = kSplitBatchSize;
+          }
+
+          level_node->evaluators.at(i).Initialize(
+              params.class_count, &train_set,
+              !!params.learn_split_thresholds);
+          if (!level_node->evaluators.at(i).SetFunctions(
+                  &level_node->trial_functions.at(trial_start), trial_count,
+                  error)) {
+            return false;
+          }
+        }
+
+        group_size += node_accumulator_size;
+        group_end++;
+      }
+
+      // Stream over all samples, routing each to the accumulators of its
+      // open node (if it belongs to the current group).
+      bool route_samples = (0 == group_start && depth > 0);
+
+      for (uint32 j = 0; j < samples.size(); j++) {
+        uint32 node_index = sample_nodes[j];
+
+        if (kClosedLevelNode == node_index) {
+          continue;
+        }
+
+        if (route_samples) {
+          const LevelWiseNode& parent = parent_level_nodes[node_index];
+          node_index = train_set.Split(parent.node->function_, samples[j])
+                           ? parent.right_index
+                           : parent.left_index;
+          sample_nodes[j] = node_index;
+        }
+
+        if (node_index < group_start || node_index >= group_end) {
+          continue;
+        }
+
+        for (auto& evaluator : level_nodes[node_index].evaluators) {
+          evaluator.AddSample(samples[j]);
+        }
+      }
+
+      // Select the best split function for each node in the group, using
+      // the same selection rules as DecisionNode::Train, and open children.
+      for (uint32 i = group_start; i < group_end; i++) {
+        LevelWiseNode* level_node = &level_nodes.at(i);
+        DecisionNode* node = level_node->node;
+        float32 best_info_gain = -1.0f;
+        Histogram best_left_hist;
+
+        SelectBestTrial(params, node->histogram_, level_node->impurity,
+                        level_node->trial_functions.data(),
+                        level_node->evaluators.data(), params.node_trial_count,
+                        &best_info_gain, &node->function_, &best_left_hist);
+
+        node->is_leaf_ = false;
+        node->left_child_.reset(new DecisionNode);
+        node->right_child_.reset(new DecisionNode);
+
+        if (!node->left_child_ || !node->right_child_) {
+          if (error) {
+            *error = "Failed to allocate child nodes.";
+          }
+          return false;
+        }
+
+        Histogram best_right_hist = node->histogram_;
+        best_right_hist -= best_left_hist;
+
+        DecisionNode* children[2] = {node->left_child_.get(),
+                                     node->right_child_.get()};
+        const Histogram* child_hists[2] = {&best_left_hist, &best_right_hist};
+        uint32* child_indices[2] = {&level_node->left_index,
+                                    &level_node->right_index};
+
+        for (uint32 c = 0; c < 2; c++) {
+          float32 child_impurity = GetImpurity(params, *child_hists[c]);
+          children[c]->histogram_ = *child_hists[c];
+          children[c]->is_leaf_ = true;
+          *child_indices[c] = kClosedLevelNode;
+
+          if (!IsLeafCriteriaMet(params, depth + 1,
+                                 child_hists[c]->GetSampleTotal(),
+                                 child_impurity)) {
+            LevelWiseNode child_level_node;
+            child_level_node.node = children[c];
+            child_level_node.impurity = child_impurity;
+            *child_indices[c] = next_level_nodes.size();
+            next_level_nodes.push_back(child_level_node);
+          }
+        }
+
+        // Release our accumulators before evaluating the next group.
+        vector<SplitFunction>().swap(level_node->trial_functions);
+        vector<SplitEvaluator>().swap(level_node->evaluators);
+      }
+
+      group_start = group_end;
+    }
+
+    parent_level_nodes.swap(level_nodes);
+    level_nodes.swap(next_level_nodes);
+  }
+
+  return true;
 }
 
 bool DecisionTree::ClassifyPixel(uint32 x, uint32 y, Image* input,
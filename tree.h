@@ -37,8 +37,11 @@
 #include <utility>
 
 #include "base_types.h"
+#include "dataset.h"
 #include "histogram.h"
 #include "image.h"
+#include "random.h"
+#include "scheduler.h"
 #include "split.h"
 
 using ::std::ifstream;
@@ -47,6 +50,16 @@ using ::std::unique_ptr;
 
 namespace base {
 
+class FeatureBank;
+
+// Supported values for DecisionTreeParams::tree_growth_mode.
+const uint32 kTreeGrowthDepthFirst = 0;
+const uint32 kTreeGrowthLevelWise = 1;
+
+// Supported values for DecisionTreeParams::split_criterion.
+const uint32 kSplitCriterionEntropy = 0;
+const uint32 kSplitCriterionGini = 1;
+
 typedef struct DecisionTreeParams {
   // maximum depth for any decision tree.
   uint32 max_tree_depth;
@@ -59,19 +72,101 @@ typedef struct DecisionTreeParams {
   uint32 visual_search_radius;
   // minimum number of samples required to perform a split.
   uint32 min_sample_count;
+  // how to grow the tree. depth first training recurses through each node's
+  // own samples, while level wise training grows an entire depth at a time
+  // using a single streaming pass over all samples per depth.
+  uint32 tree_growth_mode;
+  // how to measure the impurity of a node's samples when selecting a split.
+  // gini impurity needs no logarithms and is cheaper to evaluate than
+  // entropy, at the cost of a slightly different choice of splits.
+  uint32 split_criterion;
+  // if non-zero, depth first nodes with more samples than this race their
+  // trials by successive halving: candidates are first scored on a random
+  // subset of this many samples, and only the better half of them are
+  // scored again on a subset twice as large, until a single block of
+  // finalists is scored on every sample. smaller values train faster at
+  // some cost in split quality. level wise training ignores this value.
+  uint32 trial_race_sample_count;
+  // if non-zero, depth first nodes with more samples than this select
+  // their split function using a uniform random sample of this many of
+  // their samples. every sample is still partitioned and counted towards
+  // the child histograms. level wise training ignores this value.
+  uint32 max_split_search_samples;
+  // if non-zero, each candidate split function compares its probe
+  // difference against the best of every possible threshold, rather than
+  // against zero. thresholds are found with a single pass over the samples,
+  // but each trial accumulates a per-class histogram of differences, which
+  // greatly increases the memory used by level wise training.
+  uint32 learn_split_thresholds;
+  // if non-zero, depth first training draws a bank of this many split
+  // functions per tree and precomputes every sample's response to each of
+  // them as a bit, after which nodes select their node_trial_count trials
+  // from the bank and count them with bitwise and plus popcount. the bank
+  // uses feature_bank_size bits per sample, and its splits always use a
+  // threshold of zero. level wise training ignores this value.
+  uint32 feature_bank_size;
 } DecisionTreeParams;
 
+// Describes the training data that a tree is trained on. Individual samples
+// (pixels within training images) are identified by 32 bit ids that pack
+// the index of the sample's image into the upper bits and the sample's
+// pixel offset within that image (y * width + x) into the lower pixel_bits
+// bits.
 typedef struct TrainSet {
-  // The underlying image set for the sample.
-  ImageSet *data_source;
-  // The coordinates within the training set that
-  // identify our current sample.
-  SplitCoord coord;
-
-  TrainSet(ImageSet *data, uint32 x, uint32 y) {
-    data_source = data;
-    coord.x = x;
-    coord.y = y;
+  // The labelled images that samples are drawn from.
+  const Dataset *data;
+  // The dimensions shared by all images.
+  uint32 width;
+  uint32 height;
+  // The distance, in bytes, between consecutive rows of an image.
+  uint32 row_stride;
+  // The number of low bits of a sample id that hold its pixel offset.
+  uint32 pixel_bits;
+  // True if the images carry a mirrored border wide enough for every split
+  // function, in which case splits are evaluated with SplitPadded.
+  bool is_padded;
+  // The precomputed split responses of our samples, if any.
+  const FeatureBank *feature_bank;
+
+  uint32 GetSampleId(uint32 image_index, uint32 x, uint32 y) const {
+    return (image_index << pixel_bits) | (y * width + x);
+  }
+
+  uint32 GetImageIndex(uint32 sample) const { return sample >> pixel_bits; }
+
+  uint32 GetPixelOffset(uint32 sample) const {
+    return sample & ((1u << pixel_bits) - 1);
+  }
+
+  SplitCoord GetCoord(uint32 sample) const {
+    uint32 offset = GetPixelOffset(sample);
+    SplitCoord coord = {static_cast<int32>(offset % width),
+                        static_cast<int32>(offset / width)};
+    return coord;
+  }
+
+  const uint8 *GetImageData(uint32 sample) const {
+    return data->GetImageData(GetImageIndex(sample));
+  }
+
+  // Returns the pixel of the sample itself.
+  const uint8 *GetSampleData(uint32 sample) const {
+    SplitCoord coord = GetCoord(sample);
+    return GetImageData(sample) + coord.y * row_stride + coord.x;
+  }
+
+  bool Split(const SplitFunction &function, uint32 sample) const {
+    if (is_padded) {
+      return function.SplitPadded(GetSampleData(sample), width, height,
+                                  row_stride);
+    }
+
+    return function.Split(GetCoord(sample), GetImageData(sample), width,
+                          height, row_stride);
+  }
+
+  uint8 GetLabel(uint32 sample) const {
+    return data->GetLabelData(GetImageIndex(sample))[GetPixelOffset(sample)];
   }
 } TrainSet;
 
@@ -82,9 +177,21 @@ class DecisionNode {
   // Performs N iterations to determine the best candidate split function and
   // then traverses to populate children. Halts once exit criteria (defined by
   // DecisionTreeParams) is satisfied.
+  //
+  // samples and scratch each point to sample_count sample ids within
+  // train_set. Once the best split is known the samples are partitioned
+  // (left then right) into scratch, which the children then use as their
+  // sample set, with samples serving as their scratch space.
+  //
+  // Split functions are drawn from random, and each child is given its own
+  // generator seeded from it. If a scheduler is supplied, large nodes
+  // evaluate their trials and train their children as tasks on it. The
+  // trained node does not depend on whether a scheduler is supplied.
   bool Train(const DecisionTreeParams &params, uint32 depth,
-             vector<TrainSet> *samples, const Histogram &sample_histogram,
-             string *error = nullptr);
+             const TrainSet &train_set, uint32 *samples, uint32 *scratch,
+             uint32 sample_count,
+             const Histogram &sample_histogram, RandomGenerator *random,
+             TaskScheduler *scheduler, string *error = nullptr);
   // Determines the class represented by the sample.
   bool Classify(const SplitCoord &coord, Image *data_source, Histogram *output,
                 string *error = nullptr);
@@ -95,33 +202,54 @@ class DecisionNode {
   SplitFunction function_;
   unique_ptr<DecisionNode> left_child_;
   unique_ptr<DecisionNode> right_child_;
+  // Level wise training constructs nodes directly.
+  friend class DecisionTree;
+  // Compilation flattens nodes for classification.
+  friend class CompiledForest;
   // Provide access to our serialization API.
   friend bool SaveDecisionTree(ofstream *out_stream, class DecisionTree *input,
                                string *error);
   friend bool LoadDecisionTree(ifstream *in_stream, class DecisionTree *output,
-                               string *error);
+                               uint32 version, string *error);
 };
 
 class DecisionTree {
  public:
-  // Trains the tree based on the supplied labelled training images.
-  bool Train(const DecisionTreeParams &params, vector<ImageSet> *training_data,
+  // Trains the tree based on the supplied labelled training images. The
+  // tree is fully determined by its inputs and random_seed. If a scheduler
+  // is supplied, depth first training spreads work across it.
+  bool Train(const DecisionTreeParams &params, const Dataset *training_data,
              uint32 training_start_index, uint32 training_count,
+             uint64 random_seed, TaskScheduler *scheduler = nullptr,
              string *error = nullptr);
+  // Estimates the peak memory, in bytes, used to train a tree on
+  // sample_count samples.
+  static uint64 EstimateTrainingMemory(const DecisionTreeParams &params,
+                                       uint64 sample_count);
   // Determines the class of object represented by the pixel.
   bool ClassifyPixel(uint32 x, uint32 y, Image *input, Histogram *output,
                      string *error = nullptr);
 
  private:
+  // Grows the tree one depth at a time. Each depth performs a single pass
+  // over samples, routing each sample to the trial accumulators of the open
+  // node that it currently belongs to.
+  bool TrainLevelWise(const DecisionTreeParams &params,
+                      const TrainSet &train_set, const vector<uint32> &samples,
+                      const Histogram &sample_histogram,
+                      RandomGenerator *random, string *error = nullptr);
+
   // Binary tree represents our actual decision tree struture.
   unique_ptr<DecisionNode> root_node_;
   // Cached copy of our decision tree params.
   DecisionTreeParams params_;
+  // Compilation flattens trees for classification.
+  friend class CompiledForest;
   // Provide access to our serialization API.
   friend bool SaveDecisionTree(ofstream *out_stream, DecisionTree *input,
                                string *error);
   friend bool LoadDecisionTree(ifstream *in_stream, DecisionTree *output,
-                               string *error);
+                               uint32 version, string *error);
 };
 
 }  // namespace base